@@ -0,0 +1,3 @@
+#include "Abdada.h"
+
+std::atomic<uint64_t> SearchingKeys[SEARCHING_TABLE_SIZE] = {};
@@ -0,0 +1,28 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+//keys of the nodes threads are searching right now, in the spirit of ABDADA:
+//a helper that reaches a node another thread is already on reduces it instead of duplicating the work
+constexpr int SEARCHING_TABLE_SIZE = 32768;
+
+extern std::atomic<uint64_t> SearchingKeys[SEARCHING_TABLE_SIZE];
+
+inline std::atomic<uint64_t>& searchingSlot(uint64_t zobrist)
+{
+    return SearchingKeys[zobrist & (SEARCHING_TABLE_SIZE - 1)];
+}
+inline bool isBeingSearched(uint64_t zobrist)
+{
+    return searchingSlot(zobrist).load(std::memory_order_relaxed) == zobrist;
+}
+inline void markSearching(uint64_t zobrist)
+{
+    searchingSlot(zobrist).store(zobrist, std::memory_order_relaxed);
+}
+//leaves the slot alone if another node has taken it over since
+inline void unmarkSearching(uint64_t zobrist)
+{
+    uint64_t expected = zobrist;
+    searchingSlot(zobrist).compare_exchange_strong(expected, 0, std::memory_order_relaxed);
+}
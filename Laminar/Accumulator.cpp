@@ -2,100 +2,44 @@
 #include "Bit.h"
 #include "Board.h"
 #include "Const.h"
+#include "Movegen.h"
 #include <cstring>
-void resetAccumulators(const Board& board, AccumulatorPair& accumulator)
-{
-    uint64_t whitePieces = board.occupancies[White];
-    uint64_t blackPieces = board.occupancies[Black];
 
-    memcpy(accumulator.white.values, EvalNetwork.accumulator_biases, sizeof(EvalNetwork.accumulator_biases));
-    memcpy(accumulator.black.values, EvalNetwork.accumulator_biases, sizeof(EvalNetwork.accumulator_biases));
-
-    while (whitePieces)
-    {
-        int sq = get_ls1b(whitePieces);
-
-        uint16_t whiteInputFeature = calculateIndex(White, sq, get_piece(board.mailbox[sq], White), White, false);
-        uint16_t blackInputFeature = calculateIndex(Black, sq, get_piece(board.mailbox[sq], White), White, false);
-        for (size_t i = 0; i < HL_SIZE; i++)
-        {
-            accumulator.white.values[i] += EvalNetwork.accumulator_weights[whiteInputFeature][i];
-            accumulator.black.values[i] += EvalNetwork.accumulator_weights[blackInputFeature][i];
-        }
-
-        Pop_bit(whitePieces, sq);
-    }
-    while (blackPieces)
+//feature indices of every piece on the board seen from one perspective
+static int collectFeatures(const Board& board, int perspective, bool flipFile, size_t* features)
+{
+    int count = 0;
+    for (int side = White; side <= Black; side++)
     {
-        int sq = get_ls1b(blackPieces);
-
-        uint16_t whiteInputFeature = calculateIndex(White, sq, get_piece(board.mailbox[sq], White), Black, false);
-        uint16_t blackInputFeature = calculateIndex(Black, sq, get_piece(board.mailbox[sq], White), Black, false);
-        for (size_t i = 0; i < HL_SIZE; i++)
+        uint64_t pieces = board.occupancies[side];
+        while (pieces)
         {
-            accumulator.white.values[i] += EvalNetwork.accumulator_weights[whiteInputFeature][i];
-            accumulator.black.values[i] += EvalNetwork.accumulator_weights[blackInputFeature][i];
+            int sq = get_ls1b(pieces);
+            features[count++] = calculateIndex(perspective, sq, get_piece(board.mailbox[sq], White), side, flipFile);
+            Pop_bit(pieces, sq);
         }
-        Pop_bit(blackPieces, sq);
     }
+    return count;
+}
+void resetAccumulators(const Board& board, AccumulatorPair& accumulator)
+{
+    //mirror each perspective if its king is on the right half of the board
+    resetWhiteAccumulator(board, accumulator, getFile(get_ls1b(board.bitboards[K])) >= 4);
+    resetBlackAccumulator(board, accumulator, getFile(get_ls1b(board.bitboards[k])) >= 4);
 }
 void resetWhiteAccumulator(const Board& board, AccumulatorPair& accumulator, bool flipFile)
 {
-    uint64_t whitePieces = board.occupancies[White];
-    uint64_t blackPieces = board.occupancies[Black];
-
-    memcpy(accumulator.white.values, EvalNetwork.accumulator_biases, sizeof(EvalNetwork.accumulator_biases));
-
-    while (whitePieces)
-    {
-        int sq = get_ls1b(whitePieces);
-
-        uint16_t whiteInputFeature = calculateIndex(White, sq, get_piece(board.mailbox[sq], White), White, flipFile);
-        for (size_t i = 0; i < HL_SIZE; i++)
-        {
-            accumulator.white.values[i] += EvalNetwork.accumulator_weights[whiteInputFeature][i];
-        }
-
-        Pop_bit(whitePieces, sq);
-    }
-    while (blackPieces)
-    {
-        int sq = get_ls1b(blackPieces);
-
-        uint16_t whiteInputFeature = calculateIndex(White, sq, get_piece(board.mailbox[sq], White), Black, flipFile);
-        for (size_t i = 0; i < HL_SIZE; i++)
-        {
-            accumulator.white.values[i] += EvalNetwork.accumulator_weights[whiteInputFeature][i];
-        }
-        Pop_bit(blackPieces, sq);
-    }
+    size_t features[32];
+    int count = collectFeatures(board, White, flipFile, features);
+    const LoadedNetwork& network = *ThreadNetwork;
+    accumulatorUpdate(network, network.accumulatorBiases(), &accumulator.white, features, count, nullptr, 0);
 }
 void resetBlackAccumulator(const Board& board, AccumulatorPair& accumulator, bool flipFile)
 {
-    uint64_t whitePieces = board.occupancies[White];
-    uint64_t blackPieces = board.occupancies[Black];
-    memcpy(accumulator.black.values, EvalNetwork.accumulator_biases, sizeof(EvalNetwork.accumulator_biases));
-
-    while (whitePieces)
-    {
-        int sq = get_ls1b(whitePieces);
-        uint16_t blackInputFeature = calculateIndex(Black, sq, get_piece(board.mailbox[sq], White), White, flipFile);
-        for (size_t i = 0; i < HL_SIZE; i++)
-        {
-            accumulator.black.values[i] += EvalNetwork.accumulator_weights[blackInputFeature][i];
-        }
-        Pop_bit(whitePieces, sq);
-    }
-    while (blackPieces)
-    {
-        int sq = get_ls1b(blackPieces);
-        uint16_t blackInputFeature = calculateIndex(Black, sq, get_piece(board.mailbox[sq], White), Black, flipFile);
-        for (size_t i = 0; i < HL_SIZE; i++)
-        {
-            accumulator.black.values[i] += EvalNetwork.accumulator_weights[blackInputFeature][i];
-        }
-        Pop_bit(blackPieces, sq);
-    }
+    size_t features[32];
+    int count = collectFeatures(board, Black, flipFile, features);
+    const LoadedNetwork& network = *ThreadNetwork;
+    accumulatorUpdate(network, network.accumulatorBiases(), &accumulator.black, features, count, nullptr, 0);
 }
 int flipHorizontal(int square)
 {
@@ -118,14 +62,173 @@ int calculateIndex(int perspective, int square, int pieceType, int side, bool mi
     }
     return 6 * 64 * (side != perspective) + 64 * pieceType + square;
 }
-void accumulatorAdd(struct Network* const network, struct Accumulator* accumulator, size_t index)
+void accumulatorAdd(const LoadedNetwork& network, struct Accumulator* accumulator, size_t index)
+{
+    accumulatorUpdate(network, accumulator->values, accumulator, &index, 1, nullptr, 0);
+}
+
+void accumulatorSub(const LoadedNetwork& network, struct Accumulator* accumulator, size_t index)
+{
+    accumulatorUpdate(network, accumulator->values, accumulator, nullptr, 0, &index, 1);
+}
+
+void AccumulatorCache::reset()
 {
-    for (int i = 0; i < HL_SIZE; i++)
-        accumulator->values[i] += network->accumulator_weights[index][i];
+    const LoadedNetwork& network = *ThreadNetwork;
+    for (int perspective = White; perspective <= Black; perspective++)
+    {
+        for (int mirror = 0; mirror < 2; mirror++)
+        {
+            AccumulatorCacheEntry& entry = entries[perspective][mirror];
+            size_t size = network.arch->hiddenSize * sizeof(int16_t);
+            memcpy(entry.accumulator.values, network.accumulatorBiases(), size);
+            memset(entry.bitboards, 0, sizeof(entry.bitboards));
+        }
+    }
 }
 
-void accumulatorSub(struct Network* const network, struct Accumulator* accumulator, size_t index)
+void AccumulatorCache::refresh(const Board& board, Accumulator& accumulator, int perspective, bool mirror)
 {
-    for (int i = 0; i < HL_SIZE; i++)
-        accumulator->values[i] -= network->accumulator_weights[index][i];
-}
\ No newline at end of file
+    AccumulatorCacheEntry& entry = entries[perspective][mirror];
+    size_t adds[32];
+    size_t subs[32];
+    int addCount = 0;
+    int subCount = 0;
+    for (int piece = P; piece <= k; piece++)
+    {
+        int side = piece <= 5 ? White : Black;
+        int pieceType = get_piece(piece, White);
+        uint64_t added = board.bitboards[piece] & ~entry.bitboards[piece];
+        uint64_t removed = entry.bitboards[piece] & ~board.bitboards[piece];
+        while (added)
+        {
+            int sq = get_ls1b(added);
+            adds[addCount++] = calculateIndex(perspective, sq, pieceType, side, mirror);
+            Pop_bit(added, sq);
+        }
+        while (removed)
+        {
+            int sq = get_ls1b(removed);
+            subs[subCount++] = calculateIndex(perspective, sq, pieceType, side, mirror);
+            Pop_bit(removed, sq);
+        }
+        entry.bitboards[piece] = board.bitboards[piece];
+    }
+    const LoadedNetwork& network = *ThreadNetwork;
+    accumulatorUpdate(network, entry.accumulator.values, &entry.accumulator, adds, addCount, subs, subCount);
+    memcpy(accumulator.values, entry.accumulator.values, network.arch->hiddenSize * sizeof(int16_t));
+}
+
+void AccumulatorStack::reset(const Board& board)
+{
+    head = 0;
+    AccumulatorState& root = states[0];
+    root.dirty.clear();
+    root.mirror[White] = getFile(get_ls1b(board.bitboards[K])) >= 4;
+    root.mirror[Black] = getFile(get_ls1b(board.bitboards[k])) >= 4;
+    cache.reset();
+    cache.refresh(board, root.accumulator.white, White, root.mirror[White]);
+    cache.refresh(board, root.accumulator.black, Black, root.mirror[Black]);
+    root.computed[White] = true;
+    root.computed[Black] = true;
+}
+
+void AccumulatorStack::push(const Board& board)
+{
+    AccumulatorState& state = states[++head];
+    state.dirty = board.dirty;
+    state.mirror[White] = getFile(get_ls1b(board.bitboards[K])) >= 4;
+    state.mirror[Black] = getFile(get_ls1b(board.bitboards[k])) >= 4;
+    state.computed[White] = false;
+    state.computed[Black] = false;
+}
+
+inline size_t dirtyPieceIndex(const DirtyPiece& dirty, int perspective, bool mirror)
+{
+    int side = dirty.piece <= 5 ? White : Black;
+    return calculateIndex(perspective, dirty.square, get_piece(dirty.piece, White), side, mirror);
+}
+
+static void applyDirtyPieces(const AccumulatorState& prev, AccumulatorState& state, int perspective)
+{
+    const Accumulator& from = perspective == White ? prev.accumulator.white : prev.accumulator.black;
+    Accumulator& to = perspective == White ? state.accumulator.white : state.accumulator.black;
+    bool mirror = state.mirror[perspective];
+    const DirtyPieces& dirty = state.dirty;
+    const LoadedNetwork& network = *ThreadNetwork;
+
+    size_t adds[2];
+    size_t subs[2];
+    for (int i = 0; i < dirty.addCount; i++)
+    {
+        adds[i] = dirtyPieceIndex(dirty.adds[i], perspective, mirror);
+    }
+    for (int i = 0; i < dirty.subCount; i++)
+    {
+        subs[i] = dirtyPieceIndex(dirty.subs[i], perspective, mirror);
+    }
+
+    if (dirty.addCount == 1 && dirty.subCount == 1)
+    {
+        accumulatorAddSub(network, &from, &to, adds[0], subs[0]);
+    }
+    else if (dirty.addCount == 1 && dirty.subCount == 2)
+    {
+        accumulatorAddSubSub(network, &from, &to, adds[0], subs[0], subs[1]);
+    }
+    else if (dirty.addCount == 2 && dirty.subCount == 2)
+    {
+        accumulatorAddAddSubSub(network, &from, &to, adds[0], adds[1], subs[0], subs[1]);
+    }
+    else
+    {
+        memcpy(to.values, from.values, network.arch->hiddenSize * sizeof(int16_t));
+        for (int i = 0; i < dirty.addCount; i++)
+        {
+            accumulatorAdd(network, &to, adds[i]);
+        }
+        for (int i = 0; i < dirty.subCount; i++)
+        {
+            accumulatorSub(network, &to, subs[i]);
+        }
+    }
+    state.computed[perspective] = true;
+}
+
+AccumulatorPair& AccumulatorStack::current(const Board& board)
+{
+    for (int perspective = White; perspective <= Black; perspective++)
+    {
+        if (states[head].computed[perspective])
+        {
+            continue;
+        }
+        //find the closest computed ancestor, the root is always computed
+        int ancestor = head;
+        bool needsRefresh = false;
+        while (!states[ancestor].computed[perspective])
+        {
+            //king crossed the d/e file, the mirrored features can't be updated incrementally
+            if (states[ancestor].mirror[perspective] != states[ancestor - 1].mirror[perspective])
+            {
+                needsRefresh = true;
+                break;
+            }
+            ancestor--;
+        }
+
+        AccumulatorState& state = states[head];
+        if (needsRefresh)
+        {
+            Accumulator& accumulator = perspective == White ? state.accumulator.white : state.accumulator.black;
+            cache.refresh(board, accumulator, perspective, state.mirror[perspective]);
+            state.computed[perspective] = true;
+            continue;
+        }
+        for (int i = ancestor + 1; i <= head; i++)
+        {
+            applyDirtyPieces(states[i - 1], states[i], perspective);
+        }
+    }
+    return states[head].accumulator;
+}
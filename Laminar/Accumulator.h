@@ -1,38 +1,251 @@
 #pragma once
+#include "Const.h"
+#include "Simd.h"
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
 
 const int INPUT_SIZE = 768;
-const int HL_SIZE = 1024;
-const int SCALE = 400;
-const int QA = 255;
-const int QB = 64;
 
+//every architecture a net file may use as (hidden size, scale, QA, QB), each one gets its own compiled kernels
+#define NETWORK_ARCHITECTURES(X) \
+    X(512, 400, 255, 64) \
+    X(768, 400, 255, 64) \
+    X(1024, 400, 255, 64) \
+    X(1536, 400, 255, 64)
+
+#define ARCH_HIDDEN_SIZE(hiddenSize, scale, qa, qb) hiddenSize,
+//accumulators are sized for the largest architecture, smaller nets only use the front of them
+constexpr int MAX_HL_SIZE = std::max({NETWORK_ARCHITECTURES(ARCH_HIDDEN_SIZE)});
+#undef ARCH_HIDDEN_SIZE
+
+template <int HiddenSize, int Scale, int QuantA, int QuantB>
+struct NetworkArch
+{
+    static constexpr int HL_SIZE = HiddenSize;
+    static constexpr int SCALE = Scale;
+    static constexpr int QA = QuantA;
+    static constexpr int QB = QuantB;
+};
+
+template <typename Arch>
 struct Network
 {
-    alignas(64) int16_t accumulator_weights[INPUT_SIZE][HL_SIZE];
-    alignas(64) int16_t accumulator_biases[HL_SIZE];
-    alignas(64) int16_t output_weights[2 * HL_SIZE];
+    alignas(64) int16_t accumulator_weights[INPUT_SIZE][Arch::HL_SIZE];
+    alignas(64) int16_t accumulator_biases[Arch::HL_SIZE];
+    alignas(64) int16_t output_weights[2 * Arch::HL_SIZE];
     alignas(64) int16_t output_bias;
 };
 
 struct Accumulator
 {
-    alignas(64) int16_t values[HL_SIZE];
+    alignas(64) int16_t values[MAX_HL_SIZE];
 };
 struct AccumulatorPair
 {
     Accumulator white{};
     Accumulator black{};
 };
-extern Network EvalNetwork;
+
+//kernels of one registered architecture for one instruction set, the network pointer is a Network<Arch>
+struct NetworkKernels
+{
+    void (*update)(
+        const void* network,
+        const int16_t* input,
+        struct Accumulator* output,
+        const size_t* adds,
+        int addCount,
+        const size_t* subs,
+        int subCount
+    );
+    void (*addSub)(
+        const void* network,
+        const struct Accumulator* input,
+        struct Accumulator* output,
+        size_t add,
+        size_t sub
+    );
+    void (*addSubSub)(
+        const void* network,
+        const struct Accumulator* input,
+        struct Accumulator* output,
+        size_t add,
+        size_t sub1,
+        size_t sub2
+    );
+    void (*addAddSubSub)(
+        const void* network,
+        const struct Accumulator* input,
+        struct Accumulator* output,
+        size_t add1,
+        size_t add2,
+        size_t sub1,
+        size_t sub2
+    );
+    int32_t (*forward)(const void* network, const struct Accumulator* stm, const struct Accumulator* nstm);
+};
+
+struct NetworkArchitecture
+{
+    int hiddenSize;
+    int scale;
+    int qa;
+    int qb;
+    size_t networkSize;
+    NetworkKernels kernels[SIMD_LEVEL_COUNT];
+};
+
+//the net in use, its architecture and instruction set are picked once so the kernels never branch on them
+struct LoadedNetwork
+{
+    const void* weights = nullptr;
+    const NetworkArchitecture* arch = nullptr;
+    const NetworkKernels* kernels = nullptr;
+
+    const int16_t* accumulatorWeights() const
+    {
+        return static_cast<const int16_t*>(weights);
+    }
+    const int16_t* accumulatorBiases() const
+    {
+        return accumulatorWeights() + INPUT_SIZE * arch->hiddenSize;
+    }
+};
+extern LoadedNetwork EvalNetwork;
+extern thread_local const LoadedNetwork* ThreadNetwork;
+
+template <typename Arch>
+void setNetworkKernels(NetworkArchitecture& arch);
+
+struct DirtyPiece
+{
+    uint8_t piece;
+    uint8_t square;
+};
+
+//features changed by the last MakeMove, applied to the accumulator only when it is needed
+struct DirtyPieces
+{
+    DirtyPiece adds[2];
+    DirtyPiece subs[2];
+    uint8_t addCount = 0;
+    uint8_t subCount = 0;
+
+    void clear()
+    {
+        addCount = 0;
+        subCount = 0;
+    }
+    void add(int piece, int square)
+    {
+        adds[addCount++] = DirtyPiece{(uint8_t)piece, (uint8_t)square};
+    }
+    void sub(int piece, int square)
+    {
+        //promotions add the pawn on the target square and remove it right after
+        for (int i = 0; i < addCount; i++)
+        {
+            if (adds[i].piece == piece && adds[i].square == square)
+            {
+                adds[i] = adds[--addCount];
+                return;
+            }
+        }
+        subs[subCount++] = DirtyPiece{(uint8_t)piece, (uint8_t)square};
+    }
+};
+
+struct AccumulatorState
+{
+    AccumulatorPair accumulator;
+    DirtyPieces dirty;
+    bool mirror[2] = {false, false};
+    bool computed[2] = {false, false};
+};
 
 class Board;
+struct AccumulatorCacheEntry
+{
+    Accumulator accumulator;
+    uint64_t bitboards[12];
+};
+
+//last refreshed accumulator of every [perspective][mirror] bucket, a refresh only applies the pieces that changed since
+struct AccumulatorCache
+{
+    AccumulatorCacheEntry entries[2][2];
+
+    void reset();
+    void refresh(const Board& board, Accumulator& accumulator, int perspective, bool mirror);
+};
+
+//one state per made move, the vectors are only updated when Evaluate asks for them
+struct AccumulatorStack
+{
+    AccumulatorState states[MAXPLY + 1];
+    AccumulatorCache cache;
+    int head = 0;
+
+    void reset(const Board& board);
+    void push(const Board& board);
+    void pop()
+    {
+        head--;
+    }
+    AccumulatorPair& current(const Board& board);
+};
+
 int flipHorizontal(int square);
 int flipSquare(int square);
 int calculateIndex(int perspective, int square, int pieceType, int side, bool mirror);
-void accumulatorAdd(struct Network* const network, struct Accumulator* accumulator, size_t index);
-void accumulatorSub(struct Network* const network, struct Accumulator* accumulator, size_t index);
+void accumulatorAdd(const LoadedNetwork& network, struct Accumulator* accumulator, size_t index);
+void accumulatorSub(const LoadedNetwork& network, struct Accumulator* accumulator, size_t index);
+inline void accumulatorUpdate(
+    const LoadedNetwork& network,
+    const int16_t* input,
+    struct Accumulator* output,
+    const size_t* adds,
+    int addCount,
+    const size_t* subs,
+    int subCount
+)
+{
+    network.kernels->update(network.weights, input, output, adds, addCount, subs, subCount);
+}
+inline void accumulatorAddSub(
+    const LoadedNetwork& network,
+    const struct Accumulator* input,
+    struct Accumulator* output,
+    size_t add,
+    size_t sub
+)
+{
+    network.kernels->addSub(network.weights, input, output, add, sub);
+}
+inline void accumulatorAddSubSub(
+    const LoadedNetwork& network,
+    const struct Accumulator* input,
+    struct Accumulator* output,
+    size_t add,
+    size_t sub1,
+    size_t sub2
+)
+{
+    network.kernels->addSubSub(network.weights, input, output, add, sub1, sub2);
+}
+inline void accumulatorAddAddSubSub(
+    const LoadedNetwork& network,
+    const struct Accumulator* input,
+    struct Accumulator* output,
+    size_t add1,
+    size_t add2,
+    size_t sub1,
+    size_t sub2
+)
+{
+    network.kernels->addAddSubSub(network.weights, input, output, add1, add2, sub1, sub2);
+}
 void resetAccumulators(const Board& board, AccumulatorPair& accumulator);
 void resetWhiteAccumulator(const Board& board, AccumulatorPair& accumulator, bool flipFile);
-void resetBlackAccumulator(const Board& board, AccumulatorPair& accumulator, bool flipFile);
\ No newline at end of file
+void resetBlackAccumulator(const Board& board, AccumulatorPair& accumulator, bool flipFile);
@@ -1,9 +1,20 @@
 #include "Bench.h"
+#include "Accumulator.h"
+#include "Bit.h"
 #include "Const.h"
+#include "NNUE.h"
 #include "Search.h"
+#include "Threading.h"
+#include "Transpositions.h"
+#include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <cstring>
+#include <iomanip>
 #include <iostream>
 #include <string>
+#include <thread>
+#include <vector>
 std::string benchFens[] = { // fens from alexandria, ultimately from bitgenie
     "r3k2r/2pb1ppp/2pp1q2/p7/1nP1B3/1P2P3/P2N1PPP/R2QK2R w KQkq a6 0 14",
     "4rrk1/2p1b1p1/p1p3q1/4p3/2P2n1p/1P1NR2P/PB3PP1/3R1QK1 b - - 2 24",
@@ -64,22 +75,266 @@ void bench()
     auto search_end = std::chrono::steady_clock::now();
     Board board;
     uint64_t nodecount = 0;
+    uint64_t evalProbes = 0;
+    uint64_t evalHits = 0;
     int totalsearchtime = 0;
     SearchLimitations searchLimits;
+    //the caller waited for the last search, which leaves the stop flag raised once it is done
+    stopSearch.store(false);
     for (int i = 0; i < 50; i++)
     {
         parse_fen(benchFens[i], board);
+        data.keys.reset(board.zobristKey);
         //PrintBoards(board);
+        ttNewSearch();
         search_start = std::chrono::steady_clock::now();
         IterativeDeepening(board, BENCHDEPTH, searchLimits, data, true);
         search_end = std::chrono::steady_clock::now();
 
         int64_t elapsedMS = std::chrono::duration_cast<std::chrono::milliseconds>(search_end - search_start).count();
 
-        nodecount += data.searchNodeCount;
+        nodecount += data.counters.nodes.get();
+        evalProbes += data.evalCache.probes.get();
+        evalHits += data.evalCache.hits.get();
         totalsearchtime += (int)std::floor(elapsedMS);
     }
+    if (evalProbes > 0)
+    {
+        std::cout << "evalcache hitrate " << evalHits * 100 / evalProbes << "% of " << evalProbes << " probes\n";
+    }
     std::cout << nodecount << " nodes " << nodecount / (totalsearchtime + 1) * 1000 << " nps "
               << "\n";
     delete heapAllocated;
-}
\ No newline at end of file
+}
+
+//reference implementation: one full pass over the accumulator per piece
+static void scalarRefresh(const Board& board, Accumulator& accumulator, int perspective, bool mirror)
+{
+    const int hiddenSize = EvalNetwork.arch->hiddenSize;
+    const int16_t* weights = EvalNetwork.accumulatorWeights();
+    memcpy(accumulator.values, EvalNetwork.accumulatorBiases(), hiddenSize * sizeof(int16_t));
+    for (int side = White; side <= Black; side++)
+    {
+        uint64_t pieces = board.occupancies[side];
+        while (pieces)
+        {
+            int sq = get_ls1b(pieces);
+            int index = calculateIndex(perspective, sq, get_piece(board.mailbox[sq], White), side, mirror);
+            for (int i = 0; i < hiddenSize; i++)
+            {
+                accumulator.values[i] += weights[index * hiddenSize + i];
+            }
+            Pop_bit(pieces, sq);
+        }
+    }
+}
+
+//reference implementation: one full pass over the accumulator per feature
+static void scalarAddSub(const Accumulator& input, Accumulator& output, size_t add, size_t sub)
+{
+    const int hiddenSize = EvalNetwork.arch->hiddenSize;
+    const int16_t* weights = EvalNetwork.accumulatorWeights();
+    memcpy(output.values, input.values, hiddenSize * sizeof(int16_t));
+    for (int i = 0; i < hiddenSize; i++)
+    {
+        output.values[i] += weights[add * hiddenSize + i];
+    }
+    for (int i = 0; i < hiddenSize; i++)
+    {
+        output.values[i] -= weights[sub * hiddenSize + i];
+    }
+}
+
+//times the accumulator kernels against the plain loops they replaced
+void nnueBench()
+{
+    constexpr int ITERATIONS = 2000;
+    Board board;
+    AccumulatorPair* accumulators = new AccumulatorPair[2];
+    int64_t checksum = 0;
+    double scalarRefreshNs = 0, simdRefreshNs = 0, scalarUpdateNs = 0, simdUpdateNs = 0;
+
+    for (int i = 0; i < 50; i++)
+    {
+        parse_fen(benchFens[i], board);
+        bool mirror = getFile(get_ls1b(board.bitboards[K])) >= 4;
+        size_t add = calculateIndex(White, e4, N, White, mirror);
+        size_t sub = calculateIndex(White, g1, N, White, mirror);
+
+        auto start = std::chrono::steady_clock::now();
+        for (int j = 0; j < ITERATIONS; j++)
+        {
+            scalarRefresh(board, accumulators[0].white, White, mirror);
+            checksum += accumulators[0].white.values[j % EvalNetwork.arch->hiddenSize];
+        }
+        auto end = std::chrono::steady_clock::now();
+        scalarRefreshNs += std::chrono::duration<double, std::nano>(end - start).count();
+
+        start = std::chrono::steady_clock::now();
+        for (int j = 0; j < ITERATIONS; j++)
+        {
+            resetWhiteAccumulator(board, accumulators[1], mirror);
+            checksum -= accumulators[1].white.values[j % EvalNetwork.arch->hiddenSize];
+        }
+        end = std::chrono::steady_clock::now();
+        simdRefreshNs += std::chrono::duration<double, std::nano>(end - start).count();
+
+        start = std::chrono::steady_clock::now();
+        for (int j = 0; j < ITERATIONS; j++)
+        {
+            scalarAddSub(accumulators[j & 1].white, accumulators[(j + 1) & 1].white, add, sub);
+            checksum += accumulators[(j + 1) & 1].white.values[j % EvalNetwork.arch->hiddenSize];
+        }
+        end = std::chrono::steady_clock::now();
+        scalarUpdateNs += std::chrono::duration<double, std::nano>(end - start).count();
+
+        start = std::chrono::steady_clock::now();
+        for (int j = 0; j < ITERATIONS; j++)
+        {
+            accumulatorAddSub(EvalNetwork, &accumulators[j & 1].white, &accumulators[(j + 1) & 1].white, add, sub);
+            checksum -= accumulators[(j + 1) & 1].white.values[j % EvalNetwork.arch->hiddenSize];
+        }
+        end = std::chrono::steady_clock::now();
+        simdUpdateNs += std::chrono::duration<double, std::nano>(end - start).count();
+    }
+    delete[] accumulators;
+
+    int calls = 50 * ITERATIONS;
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "kernels  " << SimdLevelName(KernelLevel()) << "\n";
+    std::cout << "refresh  scalar " << scalarRefreshNs / calls << " ns  simd " << simdRefreshNs / calls << " ns  speedup "
+              << scalarRefreshNs / simdRefreshNs << "x\n";
+    std::cout << "add-sub  scalar " << scalarUpdateNs / calls << " ns  simd " << simdUpdateNs / calls << " ns  speedup "
+              << scalarUpdateNs / simdUpdateNs << "x\n";
+    std::cout << "checksum " << checksum << "\n";
+}
+
+//every field of a stress entry is derived from its key, so a hit that disagrees with its key was torn
+static TranspositionEntry stressEntry(uint64_t key, uint64_t random)
+{
+    TranspositionEntry entry;
+    entry.bestMove = Move16(key & 0x3F, (key >> 6) & 0x3F, (key >> 12) & 0xF);
+    entry.score = int((key >> 16) % (2 * MATESCORE + 1)) - MATESCORE;
+    entry.staticEval = packEval(int16_t(key >> 40));
+    entry.packedInfo = packData(random % MAXPLY, random % 3, (random >> 8) & 1);
+    return entry;
+}
+
+//hammers a small set of hot keys from many threads at once and counts hits whose fields disagree,
+//on a table of its own so the game's hash survives
+void ttStress(int threads)
+{
+    constexpr int KEYS = 1024;
+    constexpr int OPERATIONS = 4000000;
+    constexpr size_t BUCKETS = 4096;
+    std::vector<TranspositionBucket> stressTable(BUCKETS);
+    TranspositionBucket* table = stressTable.data();
+    size_t size = BUCKETS;
+    SwapTT(table, size);
+
+    uint64_t keys[KEYS];
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+    for (uint64_t& key : keys)
+    {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        key = seed;
+    }
+
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> torn{0};
+    std::vector<std::thread> workers;
+    auto start = std::chrono::steady_clock::now();
+    for (int t = 0; t < threads; t++)
+    {
+        workers.emplace_back(
+            [&, t]()
+            {
+                uint64_t random = 0x2545F4914F6CDD1DULL * (t + 1);
+                uint64_t localHits = 0;
+                uint64_t localTorn = 0;
+                for (int i = 0; i < OPERATIONS; i++)
+                {
+                    random ^= random << 13;
+                    random ^= random >> 7;
+                    random ^= random << 17;
+                    uint64_t key = keys[random % KEYS];
+                    TranspositionEntry expected = stressEntry(key, random >> 16);
+                    if (random & (1ULL << 40))
+                    {
+                        ttStore(expected, key);
+                        continue;
+                    }
+                    TranspositionEntry entry = ttLookUp(key);
+                    if (!entry.matches(key))
+                    {
+                        continue;
+                    }
+                    localHits++;
+                    if (entry.bestMove.data != expected.bestMove.data || entry.score != expected.score
+                        || entry.staticEval != expected.staticEval)
+                    {
+                        localTorn++;
+                    }
+                }
+                hits += localHits;
+                torn += localTorn;
+            }
+        );
+    }
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+    auto end = std::chrono::steady_clock::now();
+    SwapTT(table, size);
+
+    int64_t elapsedMS = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+    std::cout << "ttstress threads " << threads << " operations " << uint64_t(threads) * OPERATIONS << " hits "
+              << hits.load() << " torn " << torn.load() << " time " << elapsedMS << " ms\n";
+}
+//time to reach a fixed depth from an empty TT on the first bench positions, for 1, 2, 4 ... maxThreads threads
+void timeToDepth(int maxThreads, int depth)
+{
+    constexpr int POSITIONS = 8;
+    int64_t singleThreadMS = 0;
+    for (int threads = 1;; threads = std::min(threads * 2, maxThreads))
+    {
+        destroyWorkers();
+        startWorkers(threads);
+        int64_t totalMS = 0;
+        int64_t totalNodes = 0;
+        for (int i = 0; i < POSITIONS; i++)
+        {
+            Board board;
+            parse_fen(benchFens[i], board);
+            KeyStack keys;
+            keys.reset(board.zobristKey);
+            ClearTT();
+
+            //the info lines of the searches themselves are not wanted here
+            std::streambuf* output = std::cout.rdbuf(nullptr);
+            auto start = std::chrono::steady_clock::now();
+            startSearch(board, keys, SearchLimitations(), depth);
+            waitForSearch();
+            auto end = std::chrono::steady_clock::now();
+            std::cout.rdbuf(output);
+            std::cout.clear();
+
+            totalMS += std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+            totalNodes += CollectSearchStats().nodes;
+        }
+        if (threads == 1)
+        {
+            singleThreadMS = totalMS;
+        }
+        std::cout << "threads " << std::setw(4) << threads << "  time " << std::setw(8) << totalMS << " ms  nodes "
+                  << std::setw(12) << totalNodes << "  speedup " << std::fixed << std::setprecision(2)
+                  << double(singleThreadMS) / std::max<int64_t>(totalMS, 1) << "\n" << std::flush;
+        if (threads == maxThreads)
+        {
+            break;
+        }
+    }
+}
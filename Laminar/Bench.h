@@ -1,3 +1,6 @@
 #pragma once
 constexpr int BENCHDEPTH = 10;
 void bench();
+void nnueBench();
+void ttStress(int threads);
+void timeToDepth(int maxThreads, int depth);
@@ -2,6 +2,7 @@
 #include "Bit.h"
 #include "Const.h"
 #include "Movegen.h"
+#include <algorithm>
 #include <cstring>
 #include <iostream>
 #include <string>
@@ -84,8 +85,16 @@ Board::Board() :
     std::memset(bitboards, 0, sizeof(bitboards));
     std::memset(occupancies, 0, sizeof(occupancies));
     std::memset(mailbox, 0, sizeof(mailbox));
-    history.clear();
-    history.reserve(256);
+}
+//drops the keys no repetition check can reach anymore, for games longer than the key stack
+void TrimKeyHistory(KeyStack& keys, const Board& board)
+{
+    int reachable = std::min<int>(board.halfmove, board.pliesFromNull);
+    int first = std::max(keys.size() - 1 - reachable, 0);
+    int kept = keys.size() - first;
+
+    std::memmove(keys.keys, keys.keys + first, kept * sizeof(uint64_t));
+    keys.count = kept;
 }
 std::string CoordinatesToChessNotation(int square)
 {
@@ -156,14 +165,6 @@ void PrintBoards(Board board)
     std::cout << "    Castle_key:     " << get_castle(board.castle) << "\n";
     std::cout << "    FEN:            " << boardToFEN(board);
     std::cout << ("\n");
-
-    std::cout << "zobrist-table"
-              << "\n";
-
-    for (size_t i = 0; i < board.history.size(); i++)
-    {
-        std::cout << std::hex << board.history[i] << std::dec << "\n";
-    }
 }
 void print_mailbox(int mailbox[])
 {
@@ -1,13 +1,63 @@
 #pragma once
 #include "Accumulator.h"
+#include "Const.h"
 #include <cstdint>
+#include <cstring>
+#include <type_traits>
 
 #include <string>
-#include <vector>
 int getPieceFromChar(char pieceChar);
 
 char getCharFromPiece(int piece);
 
+//room for a long game played with "position ... moves" plus a full search line on top of it
+constexpr int KEY_STACK_CAPACITY = 1024 + MAXPLY + 1;
+
+//zobrist keys of every position since the root of the game, preallocated so make/unmake never touches the heap.
+//kept next to the board rather than inside it, the game owns one and every search thread owns its own
+struct KeyStack
+{
+    uint64_t keys[KEY_STACK_CAPACITY];
+    int count = 0;
+
+    inline void push_back(uint64_t key)
+    {
+        keys[count++] = key;
+    }
+    inline void pop_back()
+    {
+        count--;
+    }
+    inline void clear()
+    {
+        count = 0;
+    }
+    inline int size() const
+    {
+        return count;
+    }
+    inline uint64_t back() const
+    {
+        return keys[count - 1];
+    }
+    inline uint64_t operator[](int index) const
+    {
+        return keys[index];
+    }
+    //starts a new game at the position with this key
+    inline void reset(uint64_t rootKey)
+    {
+        count = 0;
+        push_back(rootKey);
+    }
+    //copies only the keys in use, not the whole capacity
+    inline void assign(const KeyStack& other)
+    {
+        count = other.count;
+        std::memcpy(keys, other.keys, count * sizeof(uint64_t));
+    }
+};
+
 class Board
 {
 public:
@@ -24,13 +74,27 @@ public:
     uint64_t whiteNonPawnKey;
     uint64_t blackNonPawnKey;
     uint64_t minorKey;
-    std::vector<uint64_t> history;
 
-    int lastIrreversiblePly = 0;
-    AccumulatorPair accumulator;
+    //plies since the game started or the last null move, a repetition can't reach past either
+    uint16_t pliesFromNull = 0;
+    uint16_t fullmove = 1;
+
+    //attack state of the position, worked out once by MakeMove or parse_fen and read by everything after
+    uint64_t checkers = 0ULL; //enemy pieces giving check to the side to move
+    uint64_t pinned = 0ULL;   //pieces of the side to move pinned to its own king
+    uint64_t threats = 0ULL;  //every square the side that just moved attacks
+
+    //follow captures and promotions in MakeMove instead of being recounted every node
+    uint8_t pieceCounts[12] = {};
+    int16_t material = 0; //white minus black, in MaterialValues
+    DirtyPieces dirty;
     Board();
 };
+//no heap or stack members, so handing a position to a search thread or copy-making a move is a plain memcpy
+static_assert(std::is_trivially_copyable_v<Board>);
+
 void PrintBoards(Board board);
+void TrimKeyHistory(KeyStack& keys, const Board& board);
 void print_mailbox(int mailbox[]);
 int get_castle(uint8_t castle);
 std::string CoordinatesToChessNotation(int square);
\ No newline at end of file
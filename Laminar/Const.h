@@ -117,6 +117,8 @@ constexpr uint8_t queen_promo_capture = queen_promo | capture;
 
 constexpr int Side_value[] = {0, 6};
 constexpr int Get_Whitepiece[] = {0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5};
+//plain piece values from white's point of view, for the material count the board keeps
+constexpr int MaterialValues[] = {100, 300, 300, 500, 900, 0, -100, -300, -300, -500, -900, 0};
 
 constexpr uint64_t WhiteKingCastleEmpty = (1ULL << f1) | (1ULL << g1);
 constexpr uint64_t WhiteQueenCastleEmpty = (1ULL << d1) | (1ULL << c1) | (1ULL << b1);
@@ -130,6 +132,10 @@ constexpr int MAXSCORE = 50000;
 constexpr int64_t NOLIMIT = -1;
 constexpr int MATESCORE = 49000;
 
+//per thread eval cache size in KiB, 64K entries
+constexpr int EVAL_CACHE_DEFAULT_KB = 512;
+constexpr int EVAL_CACHE_MAX_KB = 65536;
+
 extern size_t TTSize;
 
 constexpr int16_t CORRHIST_WEIGHT_SCALE = 256;
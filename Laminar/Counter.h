@@ -0,0 +1,30 @@
+#pragma once
+#include <atomic>
+
+//a statistic written only by its owning thread and read by others while it searches,
+//a relaxed load and store keeps the increment a plain add instead of a locked one
+template <typename T>
+struct RelaxedCounter
+{
+    std::atomic<T> value{0};
+
+    T get() const
+    {
+        return value.load(std::memory_order_relaxed);
+    }
+    void set(T newValue)
+    {
+        value.store(newValue, std::memory_order_relaxed);
+    }
+    void add(T amount = 1)
+    {
+        set(get() + amount);
+    }
+    void raise(T candidate)
+    {
+        if (candidate > get())
+        {
+            set(candidate);
+        }
+    }
+};
@@ -162,26 +162,15 @@ void init_tables()
 }
 int material_eval(Board& board)
 {
-    int whiteBishop = count_bits(board.bitboards[B]) * 300;
-    int blackBishop = count_bits(board.bitboards[b]) * -300;
-    int whiteKnight = count_bits(board.bitboards[N]) * 300;
-    int blackKnight = count_bits(board.bitboards[n]) * -300;
-    int whiteRook = count_bits(board.bitboards[R]) * 500;
-    int blackRook = count_bits(board.bitboards[r]) * -500;
-    int whiteQueen = count_bits(board.bitboards[Q]) * 900;
-    int blackQueen = count_bits(board.bitboards[q]) * -900;
-    int whitePawn = count_bits(board.bitboards[P]) * 100;
-    int blackPawn = count_bits(board.bitboards[p]) * -100;
-    return (whiteBishop + blackBishop + whiteKnight + blackKnight + whiteRook + blackRook + whiteQueen + blackQueen
-            + whitePawn + blackPawn)
-         * (board.side == Black ? -1 : 1);
+    return board.material * (board.side == Black ? -1 : 1);
 }
+//weighted from the piece counts rather than kept on the board, the weights are tuneable at runtime
 int material_phase(Board& board)
 {
-    int knights = count_bits(board.bitboards[N] | board.bitboards[n]);
-    int bishops = count_bits(board.bitboards[B] | board.bitboards[b]);
-    int rooks = count_bits(board.bitboards[R] | board.bitboards[r]);
-    int queens = count_bits(board.bitboards[Q] | board.bitboards[q]);
+    int knights = board.pieceCounts[N] + board.pieceCounts[n];
+    int bishops = board.pieceCounts[B] + board.pieceCounts[b];
+    int rooks = board.pieceCounts[R] + board.pieceCounts[r];
+    int queens = board.pieceCounts[Q] + board.pieceCounts[q];
     return SCALING_KNIGHT_VAL * knights + SCALING_BISHOP_VAL * bishops + SCALING_ROOK_VAL * rooks
          + SCALING_QUEEN_VAL * queens;
 }
@@ -192,14 +181,52 @@ int scale_evaluation(Board& board, int32_t eval)
     return eval * (SCALING_BASE + phase) / 32768;
 }
 
-int Evaluate(Board& board)
+int EvalCacheSize = EVAL_CACHE_DEFAULT_KB;
+
+EvalCache::EvalCache()
+{
+    resize(EvalCacheSize);
+}
+void EvalCache::resize(int kilobytes)
+{
+    //round down to a power of two so the key can be masked into an index
+    size_t count = static_cast<size_t>(kilobytes) * 1024 / sizeof(uint64_t);
+    while (count & (count - 1))
+    {
+        count &= count - 1;
+    }
+    entries.assign(count, 0);
+    mask = count > 0 ? count - 1 : 0;
+    probes.set(0);
+    hits.set(0);
+}
+void EvalCache::clear()
+{
+    std::fill(entries.begin(), entries.end(), 0);
+    probes.set(0);
+    hits.set(0);
+}
+
+int Evaluate(Board& board, AccumulatorPair& accumulator)
 {
     int NN_score;
     if (board.side == White)
-        NN_score = forward(&EvalNetwork, &board.accumulator.white, &board.accumulator.black);
+        NN_score = forward(*ThreadNetwork, &accumulator.white, &accumulator.black);
     else
-        NN_score = forward(&EvalNetwork, &board.accumulator.black, &board.accumulator.white);
+        NN_score = forward(*ThreadNetwork, &accumulator.black, &accumulator.white);
 
     NN_score = scale_evaluation(board, NN_score);
     return NN_score;
+}
+int Evaluate(Board& board, AccumulatorStack& accumulators, EvalCache& cache)
+{
+    int eval;
+    if (cache.probe(board.zobristKey, eval))
+    {
+        return eval;
+    }
+    //the accumulators are only brought up to date on a miss
+    eval = Evaluate(board, accumulators.current(board));
+    cache.store(board.zobristKey, eval);
+    return eval;
 }
\ No newline at end of file
@@ -1,5 +1,53 @@
 #pragma once
 #include "Board.h"
+#include "Const.h"
+#include "Counter.h"
+#include <cstdint>
+#include <vector>
+
+//direct-mapped cache of network evals, one per search thread
+//each slot packs the upper 48 bits of the zobrist key with the 16 bit eval
+struct EvalCache
+{
+    std::vector<uint64_t> entries;
+    uint64_t mask = 0;
+
+    RelaxedCounter<uint64_t> probes;
+    RelaxedCounter<uint64_t> hits;
+
+    EvalCache();
+    void resize(int kilobytes);
+    void clear();
+
+    bool probe(uint64_t zobrist, int& eval)
+    {
+        if (entries.empty())
+        {
+            return false;
+        }
+        probes.add();
+        uint64_t entry = entries[zobrist & mask];
+        if ((entry ^ zobrist) >> 16 != 0)
+        {
+            return false;
+        }
+        hits.add();
+        eval = static_cast<int16_t>(entry & 0xFFFF);
+        return true;
+    }
+    void store(uint64_t zobrist, int eval)
+    {
+        //evals outside int16 are rare enough to simply recompute
+        if (entries.empty() || eval < INT16_MIN || eval > INT16_MAX)
+        {
+            return;
+        }
+        entries[zobrist & mask] = (zobrist & ~0xFFFFULL) | static_cast<uint16_t>(eval);
+    }
+};
+extern int EvalCacheSize;
+
 void init_tables();
-int Evaluate(Board& board);
-int material_eval(Board& board);
\ No newline at end of file
+int Evaluate(Board& board, AccumulatorPair& accumulator);
+int Evaluate(Board& board, AccumulatorStack& accumulators, EvalCache& cache);
+int material_eval(Board& board);
@@ -0,0 +1,95 @@
+#include "Accumulator.h"
+#include "Simd.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#if is_x86
+    #include <immintrin.h>
+#endif
+
+//the same kernels are compiled once per instruction set, and the best one the CPU supports is picked at runtime,
+//so one binary runs at full speed on every x86 machine without being built with -march for it
+#define KERNEL_ISA_SCALAR 0
+#define KERNEL_ISA_SSE2 1
+#define KERNEL_ISA_AVX2 2
+#define KERNEL_ISA_AVX512 3
+#define KERNEL_ISA_AVX512_VNNI 4
+
+#define KERNEL_PRAGMA(x) _Pragma(#x)
+#if defined(__clang__)
+    #define KERNEL_TARGET_PUSH(isa) KERNEL_PRAGMA(clang attribute push(__attribute__((target(isa))), apply_to = function))
+    #define KERNEL_TARGET_POP KERNEL_PRAGMA(clang attribute pop)
+#elif defined(__GNUC__)
+    #define KERNEL_TARGET_PUSH(isa) KERNEL_PRAGMA(GCC push_options) KERNEL_PRAGMA(GCC target(isa))
+    #define KERNEL_TARGET_POP KERNEL_PRAGMA(GCC pop_options)
+#else
+    #define KERNEL_TARGET_PUSH(isa)
+    #define KERNEL_TARGET_POP
+#endif
+
+namespace ScalarKernels
+{
+#define KERNEL_ISA KERNEL_ISA_SCALAR
+#include "SimdKernels.h"
+#undef KERNEL_ISA
+} // namespace ScalarKernels
+
+#if is_x86
+KERNEL_TARGET_PUSH("sse2")
+namespace Sse2Kernels
+{
+    #define KERNEL_ISA KERNEL_ISA_SSE2
+    #include "SimdKernels.h"
+    #undef KERNEL_ISA
+} // namespace Sse2Kernels
+KERNEL_TARGET_POP
+
+KERNEL_TARGET_PUSH("avx2")
+namespace Avx2Kernels
+{
+    #define KERNEL_ISA KERNEL_ISA_AVX2
+    #include "SimdKernels.h"
+    #undef KERNEL_ISA
+} // namespace Avx2Kernels
+KERNEL_TARGET_POP
+
+KERNEL_TARGET_PUSH("avx512f,avx512bw")
+namespace Avx512Kernels
+{
+    #define KERNEL_ISA KERNEL_ISA_AVX512
+    #include "SimdKernels.h"
+    #undef KERNEL_ISA
+} // namespace Avx512Kernels
+KERNEL_TARGET_POP
+
+KERNEL_TARGET_PUSH("avx512f,avx512bw,avx512vnni")
+namespace Avx512VnniKernels
+{
+    #define KERNEL_ISA KERNEL_ISA_AVX512_VNNI
+    #include "SimdKernels.h"
+    #undef KERNEL_ISA
+} // namespace Avx512VnniKernels
+KERNEL_TARGET_POP
+#endif
+
+template <typename Arch>
+void setNetworkKernels(NetworkArchitecture& arch)
+{
+    arch.kernels[SIMD_SCALAR] = ScalarKernels::kernels<Arch>();
+#if is_x86
+    arch.kernels[SIMD_SSE2] = Sse2Kernels::kernels<Arch>();
+    arch.kernels[SIMD_AVX2] = Avx2Kernels::kernels<Arch>();
+    arch.kernels[SIMD_AVX512] = Avx512Kernels::kernels<Arch>();
+    arch.kernels[SIMD_AVX512_VNNI] = Avx512VnniKernels::kernels<Arch>();
+#else
+    for (int level = SIMD_SCALAR + 1; level < SIMD_LEVEL_COUNT; level++)
+    {
+        arch.kernels[level] = arch.kernels[SIMD_SCALAR];
+    }
+#endif
+}
+#define INSTANTIATE_NETWORK_KERNELS(hiddenSize, scale, qa, qb) \
+    template void setNetworkKernels<NetworkArch<hiddenSize, scale, qa, qb>>(NetworkArchitecture & arch);
+NETWORK_ARCHITECTURES(INSTANTIATE_NETWORK_KERNELS)
+#undef INSTANTIATE_NETWORK_KERNELS
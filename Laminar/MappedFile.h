@@ -0,0 +1,100 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+#if defined(_WIN32)
+    #define NOMINMAX
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+//read-only view of a file, the pages are shared between every process mapping the same file
+struct MappedFile
+{
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+#if defined(_WIN32)
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+
+    bool open(const std::string& filepath)
+    {
+#if defined(_WIN32)
+        file = CreateFileA(
+            filepath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr
+        );
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            return false;
+        }
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+        {
+            close();
+            return false;
+        }
+        size = static_cast<size_t>(fileSize.QuadPart);
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping == nullptr)
+        {
+            close();
+            return false;
+        }
+        data = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+        int fd = ::open(filepath.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0)
+        {
+            ::close(fd);
+            return false;
+        }
+        size = static_cast<size_t>(st.st_size);
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        data = mapped == MAP_FAILED ? nullptr : static_cast<const unsigned char*>(mapped);
+#endif
+        if (data == nullptr)
+        {
+            close();
+            return false;
+        }
+        return true;
+    }
+    void close()
+    {
+#if defined(_WIN32)
+        if (data != nullptr)
+        {
+            UnmapViewOfFile(data);
+        }
+        if (mapping != nullptr)
+        {
+            CloseHandle(mapping);
+        }
+        if (file != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(file);
+        }
+        file = INVALID_HANDLE_VALUE;
+        mapping = nullptr;
+#else
+        if (data != nullptr)
+        {
+            munmap(const_cast<unsigned char*>(data), size);
+        }
+#endif
+        data = nullptr;
+        size = 0;
+    }
+};
@@ -12,6 +12,8 @@ uint64_t rook_attacks[64][4096] = {};
 uint64_t pawn_attacks[2][64] = {};
 uint64_t knight_attacks[64] = {};
 uint64_t king_attacks[64] = {};
+uint64_t BetweenSquares[64][64] = {};
+uint64_t LineSquares[64][64] = {};
 
 uint64_t piece_keys[12][64];
 uint64_t enpassant_keys[64];
@@ -126,6 +128,13 @@ void parse_fen(std::string fen, Board& board)
         int halfmoves = std::stoi(halfmoves_str);
         board.halfmove = halfmoves;
     }
+
+    board.fullmove = 1;
+    size_t fullmoveIndex = fen.find(' ', index + 1);
+    if (fullmoveIndex != std::string::npos && fullmoveIndex + 1 < fen.length() && std::isdigit(fen[fullmoveIndex + 1]))
+    {
+        board.fullmove = std::stoi(fen.substr(fullmoveIndex + 1));
+    }
     for (int piece = P; piece <= K; piece++)
     {
         board.occupancies[White] |= board.bitboards[piece];
@@ -137,34 +146,20 @@ void parse_fen(std::string fen, Board& board)
     board.occupancies[Both] |= board.occupancies[Black];
     board.occupancies[Both] |= board.occupancies[White];
     board.zobristKey = generate_hash_key(board);
-    board.history.push_back(board.zobristKey);
+    board.pliesFromNull = 0;
 
     board.pawnKey = generate_pawn_key(board);
     board.whiteNonPawnKey = generate_white_nonpawn_key(board);
     board.blackNonPawnKey = generate_black_nonpawn_key(board);
     board.minorKey = generate_black_nonpawn_key(board);
 
-    resetAccumulators(board, board.accumulator);
-
-    int whiteKingFile = getFile(get_ls1b(board.bitboards[K]));
-    if (whiteKingFile >= 4) //king is on right now, have to flip
-    {
-        resetWhiteAccumulator(board, board.accumulator, true);
-    }
-    if (whiteKingFile <= 3) //king is on left now, have to flip
-    {
-        resetWhiteAccumulator(board, board.accumulator, false);
-    }
-
-    int blackKingFile = getFile(get_ls1b(board.bitboards[k]));
-    if (blackKingFile >= 4) //king is on right now, have to flip
-    {
-        resetBlackAccumulator(board, board.accumulator, true);
-    }
-    if (blackKingFile <= 3) //king is on left now, have to flip
+    board.material = 0;
+    for (int piece = P; piece <= k; piece++)
     {
-        resetBlackAccumulator(board, board.accumulator, false);
+        board.pieceCounts[piece] = count_bits(board.bitboards[piece]);
+        board.material += board.pieceCounts[piece] * MaterialValues[piece];
     }
+    UpdateAttackState(board);
 }
 uint32_t get_random_U32_number()
 {
@@ -720,6 +715,34 @@ uint64_t get_queen_attacks(int square, uint64_t occupancy)
 
     return queen_attacks;
 }
+//squares strictly between two squares on a shared rank, file or diagonal, and the whole line through them
+void InitLineTables()
+{
+    for (int s1 = 0; s1 < 64; s1++)
+    {
+        for (int s2 = 0; s2 < 64; s2++)
+        {
+            BetweenSquares[s1][s2] = 0ULL;
+            LineSquares[s1][s2] = 0ULL;
+            if (s1 == s2)
+            {
+                continue;
+            }
+            if (get_rook_attacks(s1, 0ULL) & (1ULL << s2))
+            {
+                BetweenSquares[s1][s2] = get_rook_attacks(s1, 1ULL << s2) & get_rook_attacks(s2, 1ULL << s1);
+                LineSquares[s1][s2] = (get_rook_attacks(s1, 0ULL) & get_rook_attacks(s2, 0ULL)) | (1ULL << s1)
+                                    | (1ULL << s2);
+            }
+            else if (get_bishop_attacks(s1, 0ULL) & (1ULL << s2))
+            {
+                BetweenSquares[s1][s2] = get_bishop_attacks(s1, 1ULL << s2) & get_bishop_attacks(s2, 1ULL << s1);
+                LineSquares[s1][s2] = (get_bishop_attacks(s1, 0ULL) & get_bishop_attacks(s2, 0ULL)) | (1ULL << s1)
+                                    | (1ULL << s2);
+            }
+        }
+    }
+}
 void printMove(Move move)
 {
     std::cout
@@ -736,7 +759,62 @@ void printMove(Move move)
 
     //std::cout << ("")
 }
-void GeneratePawnMoves(MoveList& MoveList, Board& board, bool noisyOnly)
+//squares a generation mode may move to: enemy pieces for captures, empty squares for everything else
+static inline uint64_t GenTargets(Board& board, int gen)
+{
+    uint64_t targets = 0ULL;
+    if (gen & GEN_CAPTURES)
+    {
+        targets |= board.occupancies[1 - board.side];
+    }
+    if (gen & GEN_QUIETS)
+    {
+        targets |= ~board.occupancies[Both];
+    }
+    return targets;
+}
+//where a piece standing on from may move to, a pinned piece has to stay on the line through its king
+static inline uint64_t TargetsFor(const MoveGenMasks& masks, int from)
+{
+    uint64_t targets = masks.checkMask;
+    if (masks.pinned & (1ULL << from))
+    {
+        targets &= LineSquares[masks.kingSquare][from];
+    }
+    return targets;
+}
+//en passant empties two squares of one rank at once, so it is checked against the board as it would be afterwards
+static bool IsEnPassantLegal(Board& board, int from, int to, const MoveGenMasks& masks)
+{
+    int side = board.side;
+    int capturedSquare = side == White ? to + 8 : to - 8;
+    uint64_t occupancy = (board.occupancies[Both] ^ (1ULL << from) ^ (1ULL << capturedSquare)) | (1ULL << to);
+    uint64_t enemyPawns = board.bitboards[get_piece(p, 1 - side)] & ~(1ULL << capturedSquare);
+    uint64_t enemyQueens = board.bitboards[get_piece(q, 1 - side)];
+    int king = masks.kingSquare;
+
+    uint64_t attackers = (get_bishop_attacks(king, occupancy) & (board.bitboards[get_piece(b, 1 - side)] | enemyQueens))
+                       | (get_rook_attacks(king, occupancy) & (board.bitboards[get_piece(r, 1 - side)] | enemyQueens))
+                       | (knight_attacks[king] & board.bitboards[get_piece(n, 1 - side)])
+                       | (pawn_attacks[side][king] & enemyPawns);
+    return attackers == 0;
+}
+//drops the squares the king would be attacked on. the threat map is taken with the king on the board,
+//so a checking slider also covers its line past the king, the king can't hide behind itself
+static uint64_t SafeKingSquares(Board& board, uint64_t kingMoves, int kingSquare)
+{
+    uint64_t safe = kingMoves & ~board.threats;
+    uint64_t sliders = board.checkers
+                     & ~(board.bitboards[get_piece(n, 1 - board.side)] | board.bitboards[get_piece(p, 1 - board.side)]);
+    while (sliders)
+    {
+        int slider = get_ls1b(sliders);
+        safe &= ~LineSquares[kingSquare][slider] | (1ULL << slider);
+        Pop_bit(sliders, slider);
+    }
+    return safe;
+}
+void GeneratePawnMoves(MoveList& MoveList, Board& board, int gen, const MoveGenMasks& masks)
 {
     int side = board.side;
     uint64_t pawnBB, pawn_capture_mask, pawn_capture, pawnOnePush, pawnTwoPush;
@@ -761,6 +839,7 @@ void GeneratePawnMoves(MoveList& MoveList, Board& board, bool noisyOnly)
 
             uint64_t currPawnBB = 1ULL << From;
             uint64_t twoForward;
+            uint64_t targets = TargetsFor(masks, From);
 
             if (side == White)
             {
@@ -776,7 +855,7 @@ void GeneratePawnMoves(MoveList& MoveList, Board& board, bool noisyOnly)
             if ((currPawnBB & promotionSquare) != 0)
             {
                 // =======promo======= //
-                uint64_t pawnPromo = forward & ~board.occupancies[Both];
+                uint64_t pawnPromo = (gen & GEN_PROMOTIONS) ? forward & ~board.occupancies[Both] & targets : 0ULL;
                 if (pawnPromo != 0)
                 {
                     while (true)
@@ -814,7 +893,8 @@ void GeneratePawnMoves(MoveList& MoveList, Board& board, bool noisyOnly)
 
                 // =======promo_capture======= //
                 pawn_capture_mask = pawn_attacks[board.side][From];
-                pawn_capture = (pawn_capture_mask & board.occupancies[1 - side]);
+                pawn_capture = (gen & GEN_CAPTURES)
+                    ? (pawn_capture_mask & board.occupancies[1 - side]) & targets : 0ULL;
 
                 if (pawn_capture != 0)
                 {
@@ -853,12 +933,13 @@ void GeneratePawnMoves(MoveList& MoveList, Board& board, bool noisyOnly)
             }
             else
             {
-                if (!noisyOnly)
+                if (gen & GEN_QUIETS)
                 {
                     // =======pawn one square push======= //
                     pawnOnePush = (forward & ~board.occupancies[Both]);
 
                     bool isPossible = pawnOnePush != 0;
+                    pawnOnePush &= targets;
 
                     if (pawnOnePush != 0)
                     {
@@ -884,7 +965,7 @@ void GeneratePawnMoves(MoveList& MoveList, Board& board, bool noisyOnly)
                     {
                         if ((doublePushSquare & currPawnBB) != 0) //pawn on second rank
                         {
-                            pawnTwoPush = (twoForward & ~board.occupancies[Both]);
+                            pawnTwoPush = (twoForward & ~board.occupancies[Both]) & targets;
                         }
                     }
                     if (pawnTwoPush != 0)
@@ -906,7 +987,7 @@ void GeneratePawnMoves(MoveList& MoveList, Board& board, bool noisyOnly)
                 }
                 // =======pawn capture======= //
                 pawn_capture_mask = pawn_attacks[board.side][From];
-                pawn_capture = pawn_capture_mask & board.occupancies[1 - side];
+                pawn_capture = (gen & GEN_CAPTURES) ? pawn_capture_mask & board.occupancies[1 - side] & targets : 0ULL;
 
                 if (pawn_capture != 0)
                 {
@@ -926,11 +1007,11 @@ void GeneratePawnMoves(MoveList& MoveList, Board& board, bool noisyOnly)
                 }
 
                 // =======pawn enpassent capture======= //
-                if (board.enpassent != NO_SQ) // enpassent possible
+                if (board.enpassent != NO_SQ && (gen & GEN_CAPTURES)) // enpassent possible
                 {
                     enpassent = (pawn_capture_mask & (1ULL << board.enpassent));
 
-                    if (enpassent != 0)
+                    if (enpassent != 0 && IsEnPassantLegal(board, From, board.enpassent, masks))
                     {
                         while (true)
                         {
@@ -954,7 +1035,7 @@ void GeneratePawnMoves(MoveList& MoveList, Board& board, bool noisyOnly)
         }
     }
 }
-void GenerateKnightMoves(MoveList& MoveList, Board& board, bool noisyOnly)
+void GenerateKnightMoves(MoveList& MoveList, Board& board, int gen, const MoveGenMasks& masks)
 {
     int side = board.side;
     uint64_t KnightBB;
@@ -971,7 +1052,7 @@ void GenerateKnightMoves(MoveList& MoveList, Board& board, bool noisyOnly)
         while (true)
         {
             int From = get_ls1b(KnightBB);
-            uint64_t KnightMove = (knight_attacks[From] & ~board.occupancies[side]);
+            uint64_t KnightMove = knight_attacks[From] & GenTargets(board, gen) & TargetsFor(masks, From);
             if (KnightMove != 0)
             {
                 while (true)
@@ -988,7 +1069,7 @@ void GenerateKnightMoves(MoveList& MoveList, Board& board, bool noisyOnly)
                     }
                     else
                     {
-                        if (!noisyOnly)
+                        if (gen & GEN_QUIETS)
                         {
                             MoveList.add(Move(
                                 static_cast<uint8_t>(From),
@@ -1009,7 +1090,7 @@ void GenerateKnightMoves(MoveList& MoveList, Board& board, bool noisyOnly)
         }
     }
 }
-void GenerateBishopMoves(MoveList& MoveList, Board& board, bool noisyOnly)
+void GenerateBishopMoves(MoveList& MoveList, Board& board, int gen, const MoveGenMasks& masks)
 {
     int side = board.side;
     uint64_t BishopBB;
@@ -1026,7 +1107,8 @@ void GenerateBishopMoves(MoveList& MoveList, Board& board, bool noisyOnly)
         while (true)
         {
             int From = get_ls1b(BishopBB);
-            uint64_t BishopMove = (get_bishop_attacks(From, board.occupancies[Both]) & ~board.occupancies[side]);
+            uint64_t BishopMove =
+                get_bishop_attacks(From, board.occupancies[Both]) & GenTargets(board, gen) & TargetsFor(masks, From);
             if (BishopMove != 0)
             {
                 while (true)
@@ -1043,7 +1125,7 @@ void GenerateBishopMoves(MoveList& MoveList, Board& board, bool noisyOnly)
                     }
                     else
                     {
-                        if (!noisyOnly)
+                        if (gen & GEN_QUIETS)
                         {
                             MoveList.add(Move(
                                 static_cast<uint8_t>(From),
@@ -1064,7 +1146,7 @@ void GenerateBishopMoves(MoveList& MoveList, Board& board, bool noisyOnly)
         }
     }
 }
-void GenerateRookMoves(MoveList& MoveList, Board& board, bool noisyOnly)
+void GenerateRookMoves(MoveList& MoveList, Board& board, int gen, const MoveGenMasks& masks)
 {
     int side = board.side;
     uint64_t RookBB;
@@ -1082,8 +1164,8 @@ void GenerateRookMoves(MoveList& MoveList, Board& board, bool noisyOnly)
         while (true)
         {
             int From = get_ls1b(RookBB);
-            uint64_t RookMove =
-                (get_rook_attacks(static_cast<uint8_t>(From), board.occupancies[Both]) & ~board.occupancies[side]);
+            uint64_t RookMove = get_rook_attacks(static_cast<uint8_t>(From), board.occupancies[Both])
+                              & GenTargets(board, gen) & TargetsFor(masks, From);
             if (RookMove != 0)
             {
                 while (true)
@@ -1100,7 +1182,7 @@ void GenerateRookMoves(MoveList& MoveList, Board& board, bool noisyOnly)
                     }
                     else
                     {
-                        if (!noisyOnly)
+                        if (gen & GEN_QUIETS)
                         {
                             MoveList.add(Move(
                                 static_cast<uint8_t>(From),
@@ -1121,7 +1203,7 @@ void GenerateRookMoves(MoveList& MoveList, Board& board, bool noisyOnly)
         }
     }
 }
-void GenerateQueenMoves(MoveList& MoveList, Board& board, bool noisyOnly)
+void GenerateQueenMoves(MoveList& MoveList, Board& board, int gen, const MoveGenMasks& masks)
 {
     int side = board.side;
     uint64_t QueenBB;
@@ -1138,7 +1220,8 @@ void GenerateQueenMoves(MoveList& MoveList, Board& board, bool noisyOnly)
         while (true)
         {
             int From = get_ls1b(QueenBB);
-            uint64_t QueenMove = (get_queen_attacks(From, board.occupancies[Both]) & ~board.occupancies[side]);
+            uint64_t QueenMove =
+                get_queen_attacks(From, board.occupancies[Both]) & GenTargets(board, gen) & TargetsFor(masks, From);
             if (QueenMove != 0)
             {
                 while (true)
@@ -1155,7 +1238,7 @@ void GenerateQueenMoves(MoveList& MoveList, Board& board, bool noisyOnly)
                     }
                     else
                     {
-                        if (!noisyOnly)
+                        if (gen & GEN_QUIETS)
                         {
                             MoveList.add(Move(
                                 static_cast<uint8_t>(From),
@@ -1176,7 +1259,7 @@ void GenerateQueenMoves(MoveList& MoveList, Board& board, bool noisyOnly)
         }
     }
 }
-void GenerateKingMoves(MoveList& MoveList, Board& board, bool noisyOnly)
+void GenerateKingMoves(MoveList& MoveList, Board& board, int gen, const MoveGenMasks& masks)
 {
     int side = board.side;
     uint64_t KingBB;
@@ -1191,7 +1274,7 @@ void GenerateKingMoves(MoveList& MoveList, Board& board, bool noisyOnly)
     while (true)
     {
         int From = get_ls1b(KingBB);
-        uint64_t KingMove = king_attacks[From] & ~board.occupancies[side];
+        uint64_t KingMove = SafeKingSquares(board, king_attacks[From] & GenTargets(board, gen), From);
         if (KingMove != 0)
         {
             while (true)
@@ -1208,7 +1291,7 @@ void GenerateKingMoves(MoveList& MoveList, Board& board, bool noisyOnly)
                 }
                 else
                 {
-                    if (!noisyOnly)
+                    if (gen & GEN_QUIETS)
                     {
                         MoveList.add(Move(
                             static_cast<uint8_t>(From),
@@ -1228,13 +1311,15 @@ void GenerateKingMoves(MoveList& MoveList, Board& board, bool noisyOnly)
         if (KingBB == 0)
             break;
     }
-    if (!noisyOnly)
+    //no castling out of check
+    if ((gen & GEN_QUIETS) && !masks.checkers)
     {
         if (side == White)
         {
             if ((board.castle & WhiteKingCastle) != 0) // kingside castling
             {
-                if ((board.occupancies[Both] & WhiteKingCastleEmpty) == 0)
+                if ((board.occupancies[Both] & WhiteKingCastleEmpty) == 0
+                    && !(WhiteKingCastleEmpty & board.threats))
                 {
                     MoveList.add(Move(
                         static_cast<uint8_t>(e1),
@@ -1246,7 +1331,8 @@ void GenerateKingMoves(MoveList& MoveList, Board& board, bool noisyOnly)
             }
             if ((board.castle & WhiteQueenCastle) != 0)
             {
-                if ((board.occupancies[Both] & WhiteQueenCastleEmpty) == 0)
+                if ((board.occupancies[Both] & WhiteQueenCastleEmpty) == 0
+                    && !(WhiteQueenCastleAttack & board.threats))
                 {
                     MoveList.add(Move(
                         static_cast<uint8_t>(e1),
@@ -1261,7 +1347,8 @@ void GenerateKingMoves(MoveList& MoveList, Board& board, bool noisyOnly)
         {
             if ((board.castle & BlackKingCastle) != 0) // kingside castling
             {
-                if ((board.occupancies[Both] & BlackKingCastleEmpty) == 0)
+                if ((board.occupancies[Both] & BlackKingCastleEmpty) == 0
+                    && !(BlackKingCastleEmpty & board.threats))
                 {
                     MoveList.add(Move(
                         static_cast<uint8_t>(e8),
@@ -1274,7 +1361,8 @@ void GenerateKingMoves(MoveList& MoveList, Board& board, bool noisyOnly)
 
             if ((board.castle & BlackQueenCastle) != 0)
             {
-                if ((board.occupancies[Both] & BlackQueenCastleEmpty) == 0)
+                if ((board.occupancies[Both] & BlackQueenCastleEmpty) == 0
+                    && !(BlackQueenCastleAttack & board.threats))
                 {
                     MoveList.add(Move(
                         static_cast<uint8_t>(e8),
@@ -1299,7 +1387,7 @@ void XORZobrist(uint64_t& zobrist, uint64_t key)
 {
     zobrist ^= key;
 }
-void XORPieceZobrist(int piece, int square, Board& board, bool flipWhite, bool flipBlack, bool AddingPiece)
+void XORPieceZobrist(int piece, int square, Board& board, bool AddingPiece)
 {
     bool side = piece <= 5 ? White : Black;
     XORZobrist(board.zobristKey, piece_keys[piece][square]);
@@ -1327,46 +1415,14 @@ void XORPieceZobrist(int piece, int square, Board& board, bool flipWhite, bool f
         }
     }
 
-    Accumulator& accumulator = ((side == White) ? board.accumulator.white : board.accumulator.black);
-
-    if (AddingPiece) //adding piece
+    //the accumulators are updated lazily from these when the position gets evaluated
+    if (AddingPiece)
     {
-        /* std::cout << "adding"
-                  << "\n"
-                  << "flipwhite:" << flipWhite << "\n"
-                  << "flipblack: " << flipBlack << "\n"
-                  << "piece :" << getCharFromPiece(get_piece(piece, White)) << "\nside" << side << "\nsquare"
-                  << CoordinatesToChessNotation(square) << "\n\n";*/
-
-        accumulatorAdd(
-            &EvalNetwork,
-            &board.accumulator.white,
-            calculateIndex(White, square, get_piece(piece, White), side, flipWhite)
-        );
-        accumulatorAdd(
-            &EvalNetwork,
-            &board.accumulator.black,
-            calculateIndex(Black, square, get_piece(piece, White), side, flipBlack)
-        );
+        board.dirty.add(piece, square);
     }
     else
     {
-        /*std::cout << "removing"
-                  << "\n"
-                  << "flipwhite:" << flipWhite << "\n"
-                  << "flipblack: " << flipBlack << "\n"
-                  << "piece :" << getCharFromPiece(get_piece(piece, White)) << "\nside" << side << "\nsquare"
-                  << CoordinatesToChessNotation(square) << "\n\n";*/
-        accumulatorSub(
-            &EvalNetwork,
-            &board.accumulator.white,
-            calculateIndex(White, square, get_piece(piece, White), side, flipWhite)
-        );
-        accumulatorSub(
-            &EvalNetwork,
-            &board.accumulator.black,
-            calculateIndex(Black, square, get_piece(piece, White), side, flipBlack)
-        );
+        board.dirty.sub(piece, square);
     }
 }
 int GetPromotingPiece(Move& move)
@@ -1394,12 +1450,7 @@ int GetPromotingPiece(Move& move)
         return NO_PIECE;
     }
 }
-void UpdateZobrist(
-    Board& board,
-    Move& move,
-    bool flipWhite,
-    bool flipBlack
-) //have to call before doing anything to board
+void UpdateZobrist(Board& board, Move& move) //have to call before doing anything to board
 {
     bool isEP = (move.Type == ep_capture);
     bool isCapture = (move.Type & captureFlag) != 0;
@@ -1466,9 +1517,8 @@ void UpdateZobrist(
     }
     XORZobrist(board.zobristKey, side_key); //flip side
 
-    XORPieceZobrist(move.Piece, move.From, board, flipWhite, flipBlack,
-                    false);                                                  //remove piece in from square
-    XORPieceZobrist(move.Piece, move.To, board, flipWhite, flipBlack, true); //add piece in to square
+    XORPieceZobrist(move.Piece, move.From, board, false); //remove piece in from square
+    XORPieceZobrist(move.Piece, move.To, board, true);    //add piece in to square
     if (isDoublePush)
     {
         if (board.side == White)
@@ -1544,14 +1594,7 @@ void UpdateZobrist(
             capture_square = move.To;
         }
         int captured_piece = board.mailbox[capture_square];
-        XORPieceZobrist(
-            captured_piece,
-            capture_square,
-            board,
-            flipWhite,
-            flipBlack,
-            false
-        ); //remove captured piece in to square
+        XORPieceZobrist(captured_piece, capture_square, board, false); //remove captured piece in to square
     }
 
     if (isKingCastle)
@@ -1566,22 +1609,8 @@ void UpdateZobrist(
             rookSquare = h8;
         }
 
-        XORPieceZobrist(
-            board.mailbox[rookSquare],
-            rookSquare,
-            board,
-            flipWhite,
-            flipBlack,
-            false
-        ); //remove castling rook
-        XORPieceZobrist(
-            board.mailbox[rookSquare],
-            rookSquare - 2,
-            board,
-            flipWhite,
-            flipBlack,
-            true
-        ); //add castling rook
+        XORPieceZobrist(board.mailbox[rookSquare], rookSquare, board, false);    //remove castling rook
+        XORPieceZobrist(board.mailbox[rookSquare], rookSquare - 2, board, true); //add castling rook
     }
     else if (isQueenCastle)
     {
@@ -1595,34 +1624,16 @@ void UpdateZobrist(
             rookSquare = a8;
         }
 
-        XORPieceZobrist(
-            board.mailbox[rookSquare],
-            rookSquare,
-            board,
-            flipWhite,
-            flipBlack,
-            false
-        ); //remove castling rook
-        XORPieceZobrist(
-            board.mailbox[rookSquare],
-            rookSquare + 3,
-            board,
-            flipWhite,
-            flipBlack,
-            true
-        ); //add castling rook
+        XORPieceZobrist(board.mailbox[rookSquare], rookSquare, board, false);    //remove castling rook
+        XORPieceZobrist(board.mailbox[rookSquare], rookSquare + 3, board, true); //add castling rook
     }
     if (isPromo)
     {
-        XORPieceZobrist(move.Piece, move.To, board, flipWhite, flipBlack,
-                        false); //remove pawn in to square
+        XORPieceZobrist(move.Piece, move.To, board, false); //remove pawn in to square
 
         int promoPiece = GetPromotingPiece(move);
-        XORPieceZobrist(promoPiece, move.To, board, flipWhite, flipBlack,
-                        true); //add promoting piece in to square
+        XORPieceZobrist(promoPiece, move.To, board, true); //add promoting piece in to square
     }
-
-    board.history.push_back(board.zobristKey);
 }
 uint64_t zobristAfterMove(Board& board, Move& move)
 {
@@ -1648,113 +1659,36 @@ void MakeNullMove(Board& board)
     }
     board.side = 1 - board.side;
     board.zobristKey ^= side_key;
+
+    //nothing before a null move can be repeated by real moves after it
+    board.pliesFromNull = 0;
+    UpdateAttackState(board);
 }
 void UnmakeNullmove(Board& board)
 {
     board.side = 1 - board.side;
     board.zobristKey ^= side_key;
 }
-void MakeMove(Board& board, Move move)
+//captures and promotions are the only moves that change what is on the board, sign undoes the move with -1
+static inline void UpdateMaterial(Board& board, Move& move, int victim, int sign)
 {
-    bool flipWhite = false;
-    bool flipBlack = false;
-
-    int whiteKingFile = getFile(get_ls1b(board.bitboards[K]));
-    int blackKingFile = getFile(get_ls1b(board.bitboards[k]));
-
-    int stmKingFile, nstmKingFile;
-
-    if (board.side == White)
-    {
-        stmKingFile = whiteKingFile;
-        nstmKingFile = blackKingFile;
-    }
-    else
-    {
-        stmKingFile = blackKingFile;
-        nstmKingFile = whiteKingFile;
-    }
-
-    if (stmKingFile >= 4) //king is on the right, need to flip
-    {
-        if (board.side == White)
-        {
-            flipWhite = true;
-        }
-        else
-        {
-            flipBlack = true;
-        }
-    }
-    else
-    {
-        if (board.side == White)
-        {
-            flipWhite = false;
-        }
-        else
-        {
-            flipBlack = false;
-        }
-    }
-
-    if (nstmKingFile >= 4)
-    {
-        if (board.side == White)
-        {
-            flipBlack = true;
-        }
-        else
-        {
-            flipWhite = true;
-        }
-    }
-    else
+    if (victim != NO_PIECE)
     {
-        if (board.side == White)
-        {
-            flipBlack = false;
-        }
-        else
-        {
-            flipWhite = false;
-        }
+        board.pieceCounts[victim] -= sign;
+        board.material -= sign * MaterialValues[victim];
     }
-
-    if (get_piece(move.Piece, White) == K)
+    if ((move.Type & promotionFlag) != 0)
     {
-        if (getFile(move.From) <= 3) //king was left before
-        {
-            if (getFile(move.To) >= 4) //king moved to right
-            {
-                //fully refresh the stm accumulator, and change that to start mirroring
-                if (board.side == White)
-                {
-                    flipWhite = true;
-                }
-                else
-                {
-                    flipBlack = true;
-                }
-            }
-        }
-        else //king was right before
-        {
-            if (getFile(move.To) <= 3) //king moved to left
-            {
-                //fully refresh the stm accumulator, and change that to stop mirroring
-                if (board.side == White)
-                {
-                    flipWhite = false;
-                }
-                else
-                {
-                    flipBlack = false;
-                }
-            }
-        }
+        int promoPiece = GetPromotingPiece(move);
+        board.pieceCounts[move.Piece] -= sign;
+        board.pieceCounts[promoPiece] += sign;
+        board.material += sign * (MaterialValues[promoPiece] - MaterialValues[move.Piece]);
     }
-    UpdateZobrist(board, move, flipWhite, flipBlack);
+}
+void MakeMove(Board& board, Move move)
+{
+    board.dirty.clear();
+    UpdateZobrist(board, move);
     //uint64_t lzobrist = board.zobristKey;
 
     if (board.enpassent != NO_SQ)
@@ -1803,6 +1737,12 @@ void MakeMove(Board& board, Move move)
         }
     }
     board.halfmove++;
+    board.pliesFromNull++;
+    if (side == Black)
+    {
+        board.fullmove++;
+    }
+    UpdateMaterial(board, move, move.Type == ep_capture ? get_piece(p, 1 - side) : board.mailbox[move.To], 1);
     switch (move.Type)
     {
         case double_pawn_push:
@@ -1831,7 +1771,6 @@ void MakeMove(Board& board, Move move)
             if (is_move_irreversible(move))
             {
                 board.halfmove = 0;
-                board.lastIrreversiblePly = board.history.size();
             }
             break;
         }
@@ -1855,7 +1794,6 @@ void MakeMove(Board& board, Move move)
             if (is_move_irreversible(move))
             {
                 board.halfmove = 0;
-                board.lastIrreversiblePly = board.history.size();
             }
             break;
         }
@@ -1920,7 +1858,6 @@ void MakeMove(Board& board, Move move)
             if (is_move_irreversible(move))
             {
                 board.halfmove = 0;
-                board.lastIrreversiblePly = board.history.size();
             }
             break;
         }
@@ -1969,7 +1906,6 @@ void MakeMove(Board& board, Move move)
             if (is_move_irreversible(move))
             {
                 board.halfmove = 0;
-                board.lastIrreversiblePly = board.history.size();
             }
             break;
         }
@@ -2016,7 +1952,6 @@ void MakeMove(Board& board, Move move)
             if (is_move_irreversible(move))
             {
                 board.halfmove = 0;
-                board.lastIrreversiblePly = board.history.size();
             }
             break;
         }
@@ -2039,7 +1974,6 @@ void MakeMove(Board& board, Move move)
             if (is_move_irreversible(move))
             {
                 board.halfmove = 0;
-                board.lastIrreversiblePly = board.history.size();
             }
             break;
         }
@@ -2062,7 +1996,6 @@ void MakeMove(Board& board, Move move)
             if (is_move_irreversible(move))
             {
                 board.halfmove = 0;
-                board.lastIrreversiblePly = board.history.size();
             }
             break;
         }
@@ -2086,7 +2019,6 @@ void MakeMove(Board& board, Move move)
             if (is_move_irreversible(move))
             {
                 board.halfmove = 0;
-                board.lastIrreversiblePly = board.history.size();
             }
 
             break;
@@ -2111,7 +2043,6 @@ void MakeMove(Board& board, Move move)
             if (is_move_irreversible(move))
             {
                 board.halfmove = 0;
-                board.lastIrreversiblePly = board.history.size();
             }
             break;
         }
@@ -2177,7 +2108,6 @@ void MakeMove(Board& board, Move move)
             if (is_move_irreversible(move))
             {
                 board.halfmove = 0;
-                board.lastIrreversiblePly = board.history.size();
             }
             break;
         }
@@ -2244,7 +2174,6 @@ void MakeMove(Board& board, Move move)
             if (is_move_irreversible(move))
             {
                 board.halfmove = 0;
-                board.lastIrreversiblePly = board.history.size();
             }
             break;
         }
@@ -2310,7 +2239,7 @@ void MakeMove(Board& board, Move move)
 
             if (is_move_irreversible(move))
             {
-                board.lastIrreversiblePly = board.history.size();
+                board.halfmove = 0;
             }
             break;
         }
@@ -2377,7 +2306,6 @@ void MakeMove(Board& board, Move move)
             if (is_move_irreversible(move))
             {
                 board.halfmove = 0;
-                board.lastIrreversiblePly = board.history.size();
             }
             break;
         }
@@ -2420,16 +2348,17 @@ void MakeMove(Board& board, Move move)
             if (is_move_irreversible(move))
             {
                 board.halfmove = 0;
-                board.lastIrreversiblePly = board.history.size();
             }
             break;
         }
     }
+    UpdateAttackState(board);
 }
 
 void UnmakeMove(Board& board, Move move, int captured_piece)
 {
     int side = 1 - board.side;
+    UpdateMaterial(board, move, move.Type == ep_capture ? get_piece(p, 1 - side) : captured_piece, -1);
     // change castling flag
 
     if (move.Type == quiet_move || move.Type == double_pawn_push)
@@ -2756,43 +2685,202 @@ void UnmakeMove(Board& board, Move move, int captured_piece)
     board.side = 1 - board.side;
 }
 
-void GeneratePseudoLegalMoves(MoveList& MoveList, Board& board, bool noisyOnly)
+void UpdateAttackState(Board& board)
+{
+    int side = board.side;
+    int king = get_ls1b(board.bitboards[get_piece(k, side)]);
+
+    uint64_t enemyQueens = board.bitboards[get_piece(q, 1 - side)];
+    uint64_t enemyRooks = board.bitboards[get_piece(r, 1 - side)] | enemyQueens;
+    uint64_t enemyBishops = board.bitboards[get_piece(b, 1 - side)] | enemyQueens;
+
+    board.threats = GetAttackedSquares(1 - side, board, board.occupancies[Both]);
+
+    //the threat map already says whether the king is attacked, the checkers are only looked up when it is
+    board.checkers = 0ULL;
+    if (board.threats & (1ULL << king))
+    {
+        board.checkers = (knight_attacks[king] & board.bitboards[get_piece(n, 1 - side)])
+                       | (pawn_attacks[side][king] & board.bitboards[get_piece(p, 1 - side)])
+                       | (get_bishop_attacks(king, board.occupancies[Both]) & enemyBishops)
+                       | (get_rook_attacks(king, board.occupancies[Both]) & enemyRooks);
+    }
+
+    //sliders that would see the king on an empty board either check it, pin the one piece in between, or neither
+    board.pinned = 0ULL;
+    uint64_t snipers = (get_rook_attacks(king, 0ULL) & enemyRooks) | (get_bishop_attacks(king, 0ULL) & enemyBishops);
+    while (snipers)
+    {
+        int sniper = get_ls1b(snipers);
+        uint64_t blockers = BetweenSquares[king][sniper] & board.occupancies[Both];
+        if (blockers && !(blockers & (blockers - 1)) && (blockers & board.occupancies[side]))
+        {
+            board.pinned |= blockers;
+        }
+        Pop_bit(snipers, sniper);
+    }
+}
+MoveGenMasks GetMoveGenMasks(const Board& board)
+{
+    MoveGenMasks masks;
+    masks.kingSquare = get_ls1b(board.bitboards[get_piece(k, board.side)]);
+    masks.checkers = board.checkers;
+    masks.pinned = board.pinned;
+
+    if (masks.checkers)
+    {
+        int checker = get_ls1b(masks.checkers);
+        //two checkers leave nothing but king moves
+        bool doubleCheck = (masks.checkers & (masks.checkers - 1)) != 0;
+        masks.checkMask = doubleCheck ? 0ULL : BetweenSquares[masks.kingSquare][checker] | masks.checkers;
+    }
+    return masks;
+}
+//only legal moves, pins and checks are applied while generating instead of testing each move after making it
+void GenerateLegalMoves(MoveList& MoveList, Board& board, int gen, const MoveGenMasks& masks)
 {
     MoveList.clear();
 
-    GenerateQueenMoves(MoveList, board, noisyOnly);
-    GenerateRookMoves(MoveList, board, noisyOnly);
-    GenerateKnightMoves(MoveList, board, noisyOnly);
-    GenerateBishopMoves(MoveList, board, noisyOnly);
+    if (masks.checkMask != 0ULL)
+    {
+        GenerateQueenMoves(MoveList, board, gen, masks);
+        GenerateRookMoves(MoveList, board, gen, masks);
+        GenerateKnightMoves(MoveList, board, gen, masks);
+        GenerateBishopMoves(MoveList, board, gen, masks);
 
-    GeneratePawnMoves(MoveList, board, noisyOnly);
-    GenerateKingMoves(MoveList, board, noisyOnly);
+        GeneratePawnMoves(MoveList, board, gen, masks);
+    }
+    GenerateKingMoves(MoveList, board, gen, masks);
 }
-bool IsSquareAttacked(int square, int side, const Board& board, uint64_t occupancy)
+void GenerateLegalMoves(MoveList& MoveList, Board& board, int gen)
 {
-    const int bishop = (side == White) ? B : b;
-    const int rook = (side == White) ? R : r;
-    const int queen = (side == White) ? Q : q;
-    const int knight = (side == White) ? N : n;
-    const int king = (side == White) ? K : k;
-    const int pawn = (side == White) ? P : p;
-
-    if (get_bishop_attacks(square, occupancy) & (board.bitboards[bishop] | board.bitboards[queen]))
-        return true;
+    GenerateLegalMoves(MoveList, board, gen, GetMoveGenMasks(board));
+}
+//whether a move that didn't come from the generator, e.g. out of the TT or the killer table,
+//can be played here at all, leaving aside whether it exposes the king
+bool IsPseudoLegal(Board& board, Move& move)
+{
+    int side = board.side;
+    int from = move.From;
+    int to = move.To;
+    if (from == to || from >= 64 || to >= 64)
+    {
+        return false;
+    }
 
-    if (get_rook_attacks(square, occupancy) & (board.bitboards[rook] | board.bitboards[queen]))
-        return true;
+    int piece = board.mailbox[from];
+    if (piece == NO_PIECE || piece != move.Piece || (piece <= 5 ? White : Black) != side)
+    {
+        return false;
+    }
 
-    if (knight_attacks[square] & board.bitboards[knight])
-        return true;
+    int pieceType = get_piece(piece, White);
+    uint64_t toBit = 1ULL << to;
+    if (move.Type == ep_capture)
+    {
+        return pieceType == P && to == board.enpassent && (pawn_attacks[side][from] & toBit);
+    }
 
-    if (pawn_attacks[1 - side][square] & board.bitboards[pawn])
-        return true;
+    int target = board.mailbox[to];
+    bool isCapture = (move.Type & captureFlag) != 0;
+    if (isCapture != (target != NO_PIECE) || (isCapture && (target <= 5 ? White : Black) == side))
+    {
+        return false;
+    }
 
-    if (king_attacks[square] & board.bitboards[king])
-        return true;
+    if (pieceType == P)
+    {
+        uint64_t lastRank = side == White ? 0xFFULL : 0xFF00000000000000ULL;
+        bool isPromo = (move.Type & promotionFlag) != 0;
+        if (isPromo != ((toBit & lastRank) != 0))
+        {
+            return false;
+        }
+        if (isCapture)
+        {
+            return (pawn_attacks[side][from] & toBit) != 0;
+        }
 
-    return false;
+        int forward = side == White ? from - 8 : from + 8;
+        if (move.Type == double_pawn_push)
+        {
+            uint64_t startRank = side == White ? 0x00FF000000000000ULL : 0xFF00ULL;
+            int twoForward = side == White ? from - 16 : from + 16;
+            return ((1ULL << from) & startRank) && to == twoForward && board.mailbox[forward] == NO_PIECE;
+        }
+        return (move.Type == quiet_move || isPromo) && to == forward;
+    }
+
+    if (move.Type == king_castle || move.Type == queen_castle)
+    {
+        if (pieceType != K)
+        {
+            return false;
+        }
+        uint64_t occupancy = board.occupancies[Both];
+        if (side == White)
+        {
+            return move.Type == king_castle
+                     ? from == e1 && to == g1 && (board.castle & WhiteKingCastle) && !(occupancy & WhiteKingCastleEmpty)
+                     : from == e1 && to == c1 && (board.castle & WhiteQueenCastle)
+                           && !(occupancy & WhiteQueenCastleEmpty);
+        }
+        return move.Type == king_castle
+                 ? from == e8 && to == g8 && (board.castle & BlackKingCastle) && !(occupancy & BlackKingCastleEmpty)
+                 : from == e8 && to == c8 && (board.castle & BlackQueenCastle) && !(occupancy & BlackQueenCastleEmpty);
+    }
+
+    if (move.Type != quiet_move && move.Type != capture)
+    {
+        return false;
+    }
+
+    uint64_t attacks = 0ULL;
+    switch (pieceType)
+    {
+        case N:
+            attacks = knight_attacks[from];
+            break;
+        case B:
+            attacks = get_bishop_attacks(from, board.occupancies[Both]);
+            break;
+        case R:
+            attacks = get_rook_attacks(from, board.occupancies[Both]);
+            break;
+        case Q:
+            attacks = get_queen_attacks(from, board.occupancies[Both]);
+            break;
+        default:
+            attacks = king_attacks[from];
+            break;
+    }
+    return (attacks & toBit) != 0;
+}
+//legality of a pseudo-legal move, with the same tests the legal generator applies
+bool IsMoveLegal(Board& board, Move& move, const MoveGenMasks& masks)
+{
+    if (move.Type == king_castle || move.Type == queen_castle)
+    {
+        uint64_t path;
+        if (board.side == White)
+        {
+            path = move.Type == king_castle ? WhiteKingCastleEmpty : WhiteQueenCastleAttack;
+        }
+        else
+        {
+            path = move.Type == king_castle ? BlackKingCastleEmpty : BlackQueenCastleAttack;
+        }
+        return !masks.checkers && !(path & board.threats);
+    }
+    if (get_piece(move.Piece, White) == K)
+    {
+        return SafeKingSquares(board, 1ULL << move.To, move.From) != 0ULL;
+    }
+    if (move.Type == ep_capture)
+    {
+        return IsEnPassantLegal(board, move.From, move.To, masks);
+    }
+    return (TargetsFor(masks, move.From) & (1ULL << move.To)) != 0ULL;
 }
 uint64_t GetAttackedSquares(int side, Board& board, uint64_t occupancy)
 {
@@ -2861,72 +2949,9 @@ uint64_t GetAttackedSquares(int side, Board& board, uint64_t occupancy)
     return attack_map;
 }
 
-bool isLegal(Move& move, Board& board)
-{
-    uint64_t kingSquare = (board.bitboards[get_piece(K, 1 - board.side)]);
-
-    if (move.Type != king_castle && move.Type != queen_castle)
-    {
-        if (!IsSquareAttacked(get_ls1b(kingSquare), board.side, board, board.occupancies[Both]))
-        {
-            //std::cout << (1);
-            return true;
-        }
-        return false;
-    }
-    else
-    {
-        uint64_t attacked_squares = GetAttackedSquares(board.side, board, board.occupancies[Both]);
-        if (move.Type == king_castle)
-        {
-            uint64_t NoAttackArea;
-            if (1 - board.side == White)
-            {
-                NoAttackArea = WhiteKingCastleEmpty | (1ULL << e1);
-            }
-            else
-            {
-                NoAttackArea = BlackKingCastleEmpty | (1ULL << e8);
-            }
-            if ((attacked_squares & kingSquare) == 0 && (attacked_squares & NoAttackArea) == 0)
-            {
-                return true;
-            }
-            return false;
-        }
-        else // queen castle
-        {
-            uint64_t NoAttackArea;
-            if (1 - board.side == White)
-            {
-                NoAttackArea = WhiteQueenCastleAttack | (1ULL << e1);
-            }
-            else
-            {
-                NoAttackArea = BlackQueenCastleAttack | (1ULL << e8);
-            }
-            if ((attacked_squares & kingSquare) == 0 && (attacked_squares & NoAttackArea) == 0)
-            {
-                return true;
-            }
-            return false;
-        }
-
-        return false;
-    }
-}
 bool is_in_check(Board& board)
 {
-    if (IsSquareAttacked(
-            get_ls1b(board.side == White ? board.bitboards[K] : board.bitboards[k]),
-            1 - board.side,
-            board,
-            board.occupancies[Both]
-        ))
-    {
-        return true;
-    }
-    return false;
+    return board.checkers != 0ULL;
 }
 uint64_t all_attackers_to_square(Board& board, uint64_t occupied, int sq)
 {
@@ -3008,7 +3033,7 @@ std::string boardToFEN(const Board& board)
     std::string enPassant =
         (board.enpassent == NO_SQ) ? "-" : CoordinatesToChessNotation(board.enpassent); // En passant square
     std::string halfmove = std::to_string(board.halfmove);                              // Halfmove clock
-    std::string fullmove = std::to_string(board.history.size() / 2 + 1);                // Fullmove number
+    std::string fullmove = std::to_string(board.fullmove);                              // Fullmove number
 
     // Step 3: Combine all parts into the final FEN string
     std::string fen =
@@ -99,12 +99,35 @@ uint64_t generate_black_nonpawn_key(Board& board);
 void init_random_keys();
 void init_sliders_attacks(int bishop);
 void InitializeLeaper();
-void GeneratePseudoLegalMoves(MoveList& MoveList, Board& board, bool noisyOnly = false);
+//which moves a generator call emits, can be combined
+constexpr int GEN_CAPTURES = 1;   //every capture, capturing promotions and en passant included
+constexpr int GEN_PROMOTIONS = 2; //promotions that don't capture
+constexpr int GEN_QUIETS = 4;     //everything else
+constexpr int GEN_NOISY = GEN_CAPTURES | GEN_PROMOTIONS;
+constexpr int GEN_ALL = GEN_NOISY | GEN_QUIETS;
+
+//what move generation needs to emit only legal moves, worked out once per position
+struct MoveGenMasks
+{
+    //squares a non-king move has to land on: all of them out of check, none in double check
+    uint64_t checkMask = ~0ULL;
+    uint64_t pinned = 0ULL;
+    uint64_t checkers = 0ULL;
+    int kingSquare = 0;
+};
+extern uint64_t BetweenSquares[64][64];
+extern uint64_t LineSquares[64][64];
+void InitLineTables();
+//checkers, pins and threats of the board's own position, kept on the board by MakeMove and parse_fen
+void UpdateAttackState(Board& board);
+MoveGenMasks GetMoveGenMasks(const Board& board);
+void GenerateLegalMoves(MoveList& MoveList, Board& board, int gen = GEN_ALL);
+void GenerateLegalMoves(MoveList& MoveList, Board& board, int gen, const MoveGenMasks& masks);
+bool IsPseudoLegal(Board& board, Move& move);
+bool IsMoveLegal(Board& board, Move& move, const MoveGenMasks& masks);
 void printMove(Move move);
 void MakeMove(Board& board, Move move);
 void UnmakeMove(Board& board, Move move, int captured_piece);
-bool isLegal(Move& move, Board& board);
-bool IsSquareAttacked(int square, int side, const Board& board, uint64_t occupancy);
 int GetSquare(std::string squareName);
 void parse_fen(std::string fen, Board& board);
 bool is_in_check(Board& board);
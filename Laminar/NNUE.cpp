@@ -1,235 +1,418 @@
 #include "Accumulator.h"
 #include "Bit.h"
 #include "Const.h"
+#include "MappedFile.h"
+#include "NNUE.h"
+#include "Simd.h"
+#include "Threading.h"
 #include <algorithm>
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
-Network EvalNetwork;
+//the net is embedded into the binary with .incbin where the toolchain supports it, otherwise it is mapped from EVALFILE
+#if !defined(EVALFILE)
+    #define EVALFILE "nnue.bin"
+#endif
+#if defined(__GNUC__) && !defined(_MSC_VER) && !defined(NO_EMBEDDED_NET)
+    #define EMBEDDED_NET 1
+    #if defined(__APPLE__)
+        #define EMBED_SECTION ".const_data\n"
+        #define EMBED_SYMBOL(name) "_" #name
+    #elif defined(_WIN32) && !defined(_WIN64)
+        #define EMBED_SECTION ".section .rdata\n"
+        #define EMBED_SYMBOL(name) "_" #name
+    #else
+        #define EMBED_SECTION ".section .rodata\n"
+        #define EMBED_SYMBOL(name) #name
+    #endif
+__asm__(EMBED_SECTION ".balign 64\n"
+                      ".global " EMBED_SYMBOL(gEmbeddedNetworkData) "\n" EMBED_SYMBOL(gEmbeddedNetworkData) ":\n"
+                      ".incbin \"" EVALFILE "\"\n"
+                      ".global " EMBED_SYMBOL(gEmbeddedNetworkEnd) "\n" EMBED_SYMBOL(gEmbeddedNetworkEnd) ":\n"
+                      ".text\n");
+extern "C" const unsigned char gEmbeddedNetworkData[];
+extern "C" const unsigned char gEmbeddedNetworkEnd[];
+#else
+    #define EMBEDDED_NET 0
+#endif
+
+LoadedNetwork EvalNetwork;
+//what a thread evaluates with, threads pinned to a NUMA node point this at the copy on their node
+thread_local const LoadedNetwork* ThreadNetwork = &EvalNetwork;
 
 static inline const uint16_t Le = 1;
 static inline const bool IS_LITTLE_ENDIAN = *reinterpret_cast<const char*>(&Le) == 1;
-template <typename IntType>
-inline IntType readLittleEndian(std::istream& stream)
-{
-    IntType result;
 
-    if (IS_LITTLE_ENDIAN)
-        stream.read(reinterpret_cast<char*>(&result), sizeof(IntType));
-    else
+//heap copy of the weights for targets that can't use the file bytes in place
+struct AlignedDelete
+{
+    void operator()(unsigned char* ptr) const
     {
-        std::uint8_t u[sizeof(IntType)];
-        std::make_unsigned_t<IntType> v = 0;
+        ::operator delete[](ptr, std::align_val_t(64));
+    }
+};
+using OwnedWeights = std::unique_ptr<unsigned char[], AlignedDelete>;
 
-        stream.read(reinterpret_cast<char*>(u), sizeof(IntType));
-        for (size_t i = 0; i < sizeof(IntType); ++i)
-            v = (v << 8) | u[sizeof(IntType) - i - 1];
+static MappedFile mappedNetwork;
+static OwnedWeights ownedNetwork;
+static std::string networkSource = "<none>";
+static uint64_t networkHash = 0;
+static SimdLevel kernelLevel = DetectSimdLevel();
 
-        std::memcpy(&result, &v, sizeof(IntType));
-    }
+struct NetworkReplica
+{
+    LoadedNetwork network;
+    OwnedWeights weights;
+};
+//one copy of the weights per NUMA node, made by the first thread that runs there so its pages are local
+static std::vector<std::unique_ptr<NetworkReplica>> replicas;
+static std::mutex replicaMutex;
 
-    return result;
+//net files start with a 64 byte little endian header, the weights follow as the Network<Arch> it describes
+//  0  char[4]  magic "LMNR"
+//  4  u32      format version
+//  8  u32      input size
+// 12  u32      hidden size
+// 16  u32      scale
+// 20  u32      QA
+// 24  u32      QB
+// 32  u64      size of the weights in bytes
+// 40  u64      checksum of the weights
+//headerless files from older trainers are still accepted if their size matches an architecture
+constexpr char NETWORK_MAGIC[4] = {'L', 'M', 'N', 'R'};
+constexpr uint32_t NETWORK_VERSION = 1;
+constexpr size_t NETWORK_HEADER_SIZE = 64;
+
+template <typename Arch>
+static NetworkArchitecture describeArchitecture()
+{
+    static_assert(
+        offsetof(Network<Arch>, accumulator_biases) == INPUT_SIZE * Arch::HL_SIZE * sizeof(int16_t),
+        "the accumulator biases must directly follow the accumulator weights"
+    );
+    NetworkArchitecture arch{};
+    arch.hiddenSize = Arch::HL_SIZE;
+    arch.scale = Arch::SCALE;
+    arch.qa = Arch::QA;
+    arch.qb = Arch::QB;
+    arch.networkSize = sizeof(Network<Arch>);
+    setNetworkKernels<Arch>(arch);
+    return arch;
 }
-void LoadNetwork(const std::string& filepath)
+#define REGISTER_ARCHITECTURE(hiddenSize, scale, qa, qb) describeArchitecture<NetworkArch<hiddenSize, scale, qa, qb>>(),
+static const NetworkArchitecture Architectures[] = {NETWORK_ARCHITECTURES(REGISTER_ARCHITECTURE)};
+#undef REGISTER_ARCHITECTURE
+
+static uint64_t readLittleEndian(const unsigned char* data, int bytes)
 {
-    std::ifstream stream(filepath, std::ios::binary);
-    if (!stream.is_open())
+    uint64_t value = 0;
+    for (int i = bytes - 1; i >= 0; i--)
     {
-        std::cerr << "Failed to open file: " << filepath << std::endl;
+        value = (value << 8) | data[i];
+    }
+    return value;
+}
+static void writeLittleEndian(unsigned char* data, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+    {
+        data[i] = static_cast<unsigned char>(value >> (8 * i));
     }
-    // Load weightsToHL
-    for (size_t row = 0; row < INPUT_SIZE; ++row)
+}
+
+//FNV-1a over little endian 64 bit words, the weights are always a multiple of 64 bytes
+static uint64_t NetworkChecksum(const unsigned char* data, size_t size)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; i += 8)
     {
-        for (size_t col = 0; col < HL_SIZE; ++col)
+        uint64_t word;
+        if (IS_LITTLE_ENDIAN)
+        {
+            memcpy(&word, data + i, sizeof(word));
+        }
+        else
         {
-            EvalNetwork.accumulator_weights[row][col] = readLittleEndian<int16_t>(stream);
+            word = readLittleEndian(data + i, 8);
         }
+        hash ^= word;
+        hash *= 1099511628211ULL;
     }
-    // Load hiddenLayerBias
-    for (size_t i = 0; i < HL_SIZE; ++i)
+    return hash;
+}
+
+static const NetworkArchitecture* FindArchitecture(uint32_t hiddenSize, uint32_t scale, uint32_t qa, uint32_t qb)
+{
+    for (const NetworkArchitecture& arch : Architectures)
     {
-        EvalNetwork.accumulator_biases[i] = readLittleEndian<int16_t>(stream);
+        if (uint32_t(arch.hiddenSize) == hiddenSize && uint32_t(arch.scale) == scale && uint32_t(arch.qa) == qa
+            && uint32_t(arch.qb) == qb)
+        {
+            return &arch;
+        }
     }
-    // Load weightsToOut
-    for (size_t i = 0; i < 2 * HL_SIZE; ++i)
+    return nullptr;
+}
+
+//the weights are stored in little endian, so on little endian targets they are used in place
+static const void* AdoptWeights(const unsigned char* data, size_t size, OwnedWeights& owned)
+{
+    if (IS_LITTLE_ENDIAN)
     {
-        EvalNetwork.output_weights[i] = readLittleEndian<int16_t>(stream);
+        return data;
     }
-    // Load outputBias
-    EvalNetwork.output_bias = readLittleEndian<int16_t>(stream);
+    owned = OwnedWeights(static_cast<unsigned char*>(::operator new[](size, std::align_val_t(64))));
+    uint16_t* words = reinterpret_cast<uint16_t*>(owned.get());
+    for (size_t i = 0; i < size / sizeof(uint16_t); i++)
+    {
+        words[i] = static_cast<uint16_t>(readLittleEndian(data + 2 * i, 2));
+    }
+    return owned.get();
 }
-int32_t SCReLU(int32_t value, int32_t min, int32_t max)
+
+//checks a net image and points network at its weights, nothing is changed if it is rejected
+static bool ParseNetwork(
+    const unsigned char* data,
+    size_t size,
+    bool verifyChecksum,
+    const std::string& source,
+    LoadedNetwork& network,
+    OwnedWeights& owned
+)
 {
-    const int32_t clamped = std::clamp(value, min, max);
-    return clamped * clamped;
+    const NetworkArchitecture* arch = nullptr;
+    if (size >= NETWORK_HEADER_SIZE && memcmp(data, NETWORK_MAGIC, sizeof(NETWORK_MAGIC)) == 0)
+    {
+        uint32_t version = readLittleEndian(data + 4, 4);
+        uint32_t inputSize = readLittleEndian(data + 8, 4);
+        uint32_t hiddenSize = readLittleEndian(data + 12, 4);
+        uint64_t weightsSize = readLittleEndian(data + 32, 8);
+        uint64_t checksum = readLittleEndian(data + 40, 8);
+        if (version != NETWORK_VERSION)
+        {
+            std::cerr << "Invalid network file: " << source << " has format version " << version << ", expected "
+                      << NETWORK_VERSION << std::endl;
+            return false;
+        }
+        arch = FindArchitecture(
+            hiddenSize, readLittleEndian(data + 16, 4), readLittleEndian(data + 20, 4), readLittleEndian(data + 24, 4)
+        );
+        if (inputSize != INPUT_SIZE || arch == nullptr)
+        {
+            std::cerr << "Invalid network file: " << source << " has an unsupported architecture " << inputSize
+                      << "->" << hiddenSize << std::endl;
+            return false;
+        }
+        if (weightsSize != arch->networkSize || size != NETWORK_HEADER_SIZE + weightsSize)
+        {
+            std::cerr << "Invalid network file: " << source << " is " << size << " bytes, expected "
+                      << NETWORK_HEADER_SIZE + arch->networkSize << std::endl;
+            return false;
+        }
+        data += NETWORK_HEADER_SIZE;
+        if (verifyChecksum && NetworkChecksum(data, weightsSize) != checksum)
+        {
+            std::cerr << "Invalid network file: " << source << " has a bad checksum" << std::endl;
+            return false;
+        }
+    }
+    else
+    {
+        for (const NetworkArchitecture& candidate : Architectures)
+        {
+            if (candidate.networkSize == size)
+            {
+                arch = &candidate;
+                break;
+            }
+        }
+        if (arch == nullptr)
+        {
+            std::cerr << "Invalid network file: " << source << " has no header and its size matches no architecture"
+                      << std::endl;
+            return false;
+        }
+    }
+
+    network.weights = AdoptWeights(data, arch->networkSize, owned);
+    network.arch = arch;
+    network.kernels = &arch->kernels[kernelLevel];
+    return true;
 }
-//SCReLU activation function
-int32_t activation(int16_t value)
+bool LoadNetwork(const std::string& filepath)
 {
-    return SCReLU(value, 0, QA);
+    MappedFile file;
+    if (!file.open(filepath))
+    {
+        std::cerr << "Failed to open file: " << filepath << std::endl;
+        return false;
+    }
+
+    LoadedNetwork network;
+    OwnedWeights owned;
+    if (!ParseNetwork(file.data, file.size, true, filepath, network, owned))
+    {
+        file.close();
+        return false;
+    }
+    if (owned)
+    {
+        file.close();
+    }
+
+    //only release the old storage once the new net is in place
+    EvalNetwork = network;
+    DropNetworkReplicas();
+    mappedNetwork.close();
+    mappedNetwork = file;
+    ownedNetwork = std::move(owned);
+    networkSource = filepath;
+    networkHash = 0;
+    return true;
 }
-std::int32_t autovectorised_screlu(Network const* network, Accumulator const* stm, Accumulator const* nstm)
+bool LoadDefaultNetwork()
 {
-    std::int32_t accumulator{};
-    for (int i = 0; i < HL_SIZE; i++)
+#if EMBEDDED_NET
+    LoadedNetwork network;
+    OwnedWeights owned;
+    size_t size = gEmbeddedNetworkEnd - gEmbeddedNetworkData;
+    //the embedded net was checked when it was built in, skip the checksum pass over it
+    if (!ParseNetwork(gEmbeddedNetworkData, size, false, "<internal>", network, owned))
     {
-        accumulator += (int32_t)activation(stm->values[i]) * network->output_weights[i];
-        accumulator += (int32_t)activation(nstm->values[i]) * network->output_weights[i + HL_SIZE];
+        return false;
     }
-    return accumulator;
-}
-
-#if defined(__x86_64__) || defined(__amd64__) || (defined(_WIN64) && (defined(_M_X64) || defined(_M_AMD64)))
-    #define is_x86 1
-    #if defined(__AVX512F__) || defined(__AVX2__) || defined(__SSE__)
-        #define has_simd 1
-    #else
-        #define has_simd 0
-    #endif
+    EvalNetwork = network;
+    DropNetworkReplicas();
+    mappedNetwork.close();
+    ownedNetwork = std::move(owned);
+    networkSource = "<internal>";
+    networkHash = 0;
+    return true;
 #else
-// TODO: arm
-    #define is_x86 0
-    #define has_simd 0
+    return LoadNetwork(EVALFILE);
 #endif
-
-#if is_x86 && has_simd
-    #undef __AVX512F__
-    #include <immintrin.h>
-#endif
-
-std::int32_t vectorised_screlu(Network const* network, Accumulator const* stm, Accumulator const* nstm)
-{
-#if is_x86 && has_simd
-    #if defined(__AVX512F__)
-    using native_vector = __m512i;
-        #define set1_epi16 _mm512_set1_epi16
-        #define load_epi16 _mm512_load_si512
-        #define min_epi16 _mm512_min_epi16
-        #define max_epi16 _mm512_max_epi16
-        #define madd_epi16 _mm512_madd_epi16
-        #define mullo_epi16 _mm512_mullo_epi16
-        #define add_epi32 _mm512_add_epi32
-        #define reduce_epi32 _mm512_reduce_add_epi32
-    #elif defined(__AVX2__)
-    using native_vector = __m256i;
-        #define set1_epi16 _mm256_set1_epi16
-        #define load_epi16 [](auto ptr) { return _mm256_load_si256(reinterpret_cast<native_vector const*>(ptr)); }
-        #define min_epi16 _mm256_min_epi16
-        #define max_epi16 _mm256_max_epi16
-        #define madd_epi16 _mm256_madd_epi16
-        #define mullo_epi16 _mm256_mullo_epi16
-        #define add_epi32 _mm256_add_epi32
-        // based on output from zig 0.14.0 for @reduce(.Add, @as(@Vector(8, i32), x)
-        #define reduce_epi32 \
-            [](native_vector vec) \
-            { \
-                __m128i xmm1 = _mm256_extracti128_si256(vec, 1); \
-                __m128i xmm0 = _mm256_castsi256_si128(vec); \
-                xmm0 = _mm_add_epi32(xmm0, xmm1); \
-                xmm1 = _mm_shuffle_epi32(xmm0, 238); \
-                xmm0 = _mm_add_epi32(xmm0, xmm1); \
-                xmm1 = _mm_shuffle_epi32(xmm0, 85); \
-                xmm0 = _mm_add_epi32(xmm0, xmm1); \
-                return _mm_cvtsi128_si32(xmm0); \
-            }
-    #elif defined(__SSE__)
-    using native_vector = __m128i;
-        #define set1_epi16 _mm_set1_epi16
-        #define load_epi16 [](auto ptr) { return _mm_load_si128(reinterpret_cast<native_vector const*>(ptr)); }
-        #define min_epi16 _mm_min_epi16
-        #define max_epi16 _mm_max_epi16
-        #define madd_epi16 _mm_madd_epi16
-        #define mullo_epi16 _mm_mullo_epi16
-        #define add_epi32 _mm_add_epi32
-        // based on output from zig 0.14.0 for @reduce(.Add, @as(@Vector(4, i32), x)
-        #define reduce_epi32 \
-            [](native_vector vec) \
-            { \
-                __m128i xmm1 = _mm_shuffle_epi32(vec, 238); \
-                vec = _mm_add_epi32(vec, xmm1); \
-                xmm1 = _mm_shuffle_epi32(vec, 85); \
-                vec = _mm_add_epi32(vec, xmm1); \
-                return _mm_cvtsi128_si32(vec); \
-            }
-    #endif
-    constexpr auto VECTOR_SIZE = sizeof(native_vector) / sizeof(std::int16_t);
-    static_assert(
-        HL_SIZE % VECTOR_SIZE == 0,
-        "HL_SIZE must be divisible by the native register size for this vectorization implementation to work"
-    );
-    const native_vector VEC_QA = set1_epi16(QA);
-    const native_vector VEC_ZERO = set1_epi16(0);
-
-    constexpr auto UNROLL = 2;
-
-    native_vector accumulator[UNROLL] = {};
-    int i = 0;
-
-    const auto one_iteration = [&](auto idx, native_vector& acc)
+}
+//writes the net in use with a header, also converts headerless nets to the current format
+bool SaveNetwork(const std::string& filepath)
+{
+    if (EvalNetwork.arch == nullptr)
     {
-        // load accumulator values
-        const native_vector stm_accum_values = load_epi16(&stm->values[idx]);
-        const native_vector nstm_accum_values = load_epi16(&nstm->values[idx]);
-
-        // load network weights
-        const native_vector stm_weights = load_epi16(&network->output_weights[idx]);
-        const native_vector nstm_weights = load_epi16(&network->output_weights[idx + HL_SIZE]);
-
-        // clamp the values to [0, QA]
-        const native_vector stm_clamped = min_epi16(VEC_QA, max_epi16(stm_accum_values, VEC_ZERO));
-        const native_vector nstm_clamped = min_epi16(VEC_QA, max_epi16(nstm_accum_values, VEC_ZERO));
-
-        // apply lizard screlu
-        const native_vector stm_screlud = madd_epi16(stm_clamped, mullo_epi16(stm_clamped, stm_weights));
-        const native_vector nstm_screlud = madd_epi16(nstm_clamped, mullo_epi16(nstm_clamped, nstm_weights));
+        return false;
+    }
+    const NetworkArchitecture& arch = *EvalNetwork.arch;
+    const unsigned char* weights = static_cast<const unsigned char*>(EvalNetwork.weights);
+    std::vector<unsigned char> image(NETWORK_HEADER_SIZE + arch.networkSize, 0);
 
-        acc = add_epi32(acc, stm_screlud);
-        acc = add_epi32(acc, nstm_screlud);
-    };
+    memcpy(image.data(), NETWORK_MAGIC, sizeof(NETWORK_MAGIC));
+    writeLittleEndian(image.data() + 4, NETWORK_VERSION, 4);
+    writeLittleEndian(image.data() + 8, INPUT_SIZE, 4);
+    writeLittleEndian(image.data() + 12, arch.hiddenSize, 4);
+    writeLittleEndian(image.data() + 16, arch.scale, 4);
+    writeLittleEndian(image.data() + 20, arch.qa, 4);
+    writeLittleEndian(image.data() + 24, arch.qb, 4);
+    writeLittleEndian(image.data() + 32, arch.networkSize, 8);
+    unsigned char* body = image.data() + NETWORK_HEADER_SIZE;
+    for (size_t i = 0; i < arch.networkSize; i += sizeof(uint16_t))
+    {
+        uint16_t word;
+        memcpy(&word, weights + i, sizeof(word));
+        writeLittleEndian(body + i, word, 2);
+    }
+    writeLittleEndian(image.data() + 40, NetworkChecksum(body, arch.networkSize), 8);
 
-    if constexpr (HL_SIZE >= UNROLL * VECTOR_SIZE)
+    std::ofstream stream(filepath, std::ios::binary);
+    stream.write(reinterpret_cast<const char*>(image.data()), image.size());
+    return bool(stream);
+}
+const std::string& NetworkSource()
+{
+    return networkSource;
+}
+//identifies the weights in use, computed on first use so loading the embedded net stays cheap
+uint64_t NetworkHash()
+{
+    if (networkHash == 0 && EvalNetwork.arch != nullptr)
     {
-        for (; i < HL_SIZE; i += UNROLL * VECTOR_SIZE)
-        {
-            for (int j = 0; j < UNROLL; ++j)
-            {
-                one_iteration(i + j * VECTOR_SIZE, accumulator[j]);
-            }
-        }
+        const unsigned char* weights = static_cast<const unsigned char*>(EvalNetwork.weights);
+        networkHash = NetworkChecksum(weights, EvalNetwork.arch->networkSize);
+    }
+    return networkHash;
+}
+SimdLevel KernelLevel()
+{
+    return kernelLevel;
+}
+//switches the instruction set of the kernels, every level computes the same values so accumulators stay valid
+bool SetKernelLevel(SimdLevel level)
+{
+    if (level > DetectSimdLevel())
+    {
+        return false;
     }
-    for (; i < HL_SIZE; i += VECTOR_SIZE)
+    kernelLevel = level;
+    if (EvalNetwork.arch != nullptr)
     {
-        one_iteration(i, accumulator[0]);
+        EvalNetwork.kernels = &EvalNetwork.arch->kernels[kernelLevel];
     }
-    if constexpr (HL_SIZE >= UNROLL * VECTOR_SIZE)
+    std::lock_guard<std::mutex> lock(replicaMutex);
+    for (auto& replica : replicas)
     {
-        for (int j = 1; j < UNROLL; ++j)
+        if (replica)
         {
-            accumulator[0] = add_epi32(accumulator[0], accumulator[j]);
+            replica->network.kernels = EvalNetwork.kernels;
         }
     }
-    return reduce_epi32(accumulator[0]);
-#else
-    return autovectorised_screlu(network, stm, nstm);
-#endif
+    return true;
 }
-
-int32_t forward(
-    struct Network* const network,
-    struct Accumulator* const stm_accumulator,
-    struct Accumulator* const nstm_accumulator
-)
+//a node below zero means the thread is not pinned and reads the shared net
+void UseNetworkReplica(int node)
 {
-    int32_t eval = vectorised_screlu(network, stm_accumulator, nstm_accumulator);
-
-    eval /= QA;
-    eval += network->output_bias;
-
-    eval *= SCALE;
-    eval /= QA * QB;
-
-    return eval;
-}
\ No newline at end of file
+    if (node < 0 || EvalNetwork.arch == nullptr)
+    {
+        ThreadNetwork = &EvalNetwork;
+        return;
+    }
+    std::lock_guard<std::mutex> lock(replicaMutex);
+    if (replicas.size() <= size_t(node))
+    {
+        replicas.resize(node + 1);
+    }
+    std::unique_ptr<NetworkReplica>& replica = replicas[node];
+    if (!replica)
+    {
+        size_t size = EvalNetwork.arch->networkSize;
+        replica = std::make_unique<NetworkReplica>();
+        replica->weights = OwnedWeights(static_cast<unsigned char*>(::operator new[](size, std::align_val_t(64))));
+        memcpy(replica->weights.get(), EvalNetwork.weights, size);
+        replica->network = EvalNetwork;
+        replica->network.weights = replica->weights.get();
+    }
+    ThreadNetwork = &replica->network;
+}
+//copies of a replaced net, the workers are moved onto copies of the new one before the old ones can be read again
+void DropNetworkReplicas()
+{
+    {
+        std::lock_guard<std::mutex> lock(replicaMutex);
+        replicas.clear();
+    }
+    runOnWorkers(
+        [](int id, int)
+        {
+            for (auto& worker : threadPool)
+            {
+                if (worker->id == id)
+                {
+                    UseNetworkReplica(worker->node);
+                }
+            }
+        }
+    );
+}
@@ -1,9 +1,20 @@
 #pragma once
 #include "Accumulator.h"
 #include <string>
-void LoadNetwork(const std::string& filepath);
-int32_t forward(
-    struct Network* const network,
-    struct Accumulator* const stm_accumulator,
-    struct Accumulator* const nstm_accumulator
-);
\ No newline at end of file
+bool LoadNetwork(const std::string& filepath);
+bool LoadDefaultNetwork();
+bool SaveNetwork(const std::string& filepath);
+const std::string& NetworkSource();
+uint64_t NetworkHash();
+SimdLevel KernelLevel();
+bool SetKernelLevel(SimdLevel level);
+void UseNetworkReplica(int node);
+void DropNetworkReplicas();
+inline int32_t forward(
+    const LoadedNetwork& network,
+    const struct Accumulator* const stm_accumulator,
+    const struct Accumulator* const nstm_accumulator
+)
+{
+    return network.kernels->forward(network.weights, stm_accumulator, nstm_accumulator);
+}
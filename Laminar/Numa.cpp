@@ -0,0 +1,167 @@
+#include "Numa.h"
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+    #define NOMINMAX
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+#elif defined(__linux__)
+    #include <pthread.h>
+    #include <sched.h>
+#endif
+
+struct NumaNode
+{
+#if defined(_WIN32)
+    GROUP_AFFINITY affinity = {};
+#endif
+    //logical cpus of the node the process is allowed to run on
+    std::vector<int> cpus;
+};
+
+#if defined(__linux__)
+//parses sysfs lists such as "0-15,32-47"
+static std::vector<int> parseList(const std::string& list)
+{
+    std::vector<int> values;
+    size_t position = 0;
+    while (position < list.size())
+    {
+        size_t end = list.find(',', position);
+        std::string range = list.substr(position, end == std::string::npos ? std::string::npos : end - position);
+        size_t dash = range.find('-');
+        if (!range.empty())
+        {
+            int first = std::stoi(range.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for (int value = first; value <= last; value++)
+            {
+                values.push_back(value);
+            }
+        }
+        position = end == std::string::npos ? list.size() : end + 1;
+    }
+    return values;
+}
+static std::string readLine(const std::string& path)
+{
+    std::ifstream file(path);
+    std::string line;
+    std::getline(file, line);
+    return line;
+}
+#endif
+
+static std::vector<NumaNode> discoverNodes()
+{
+    std::vector<NumaNode> nodes;
+#if defined(__linux__)
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    bool restricted = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+    for (int id : parseList(readLine("/sys/devices/system/node/online")))
+    {
+        NumaNode node;
+        for (int cpu : parseList(readLine("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist")))
+        {
+            if (cpu < CPU_SETSIZE && (!restricted || CPU_ISSET(cpu, &allowed)))
+            {
+                node.cpus.push_back(cpu);
+            }
+        }
+        //memory only nodes have nothing to run on
+        if (!node.cpus.empty())
+        {
+            nodes.push_back(node);
+        }
+    }
+#elif defined(_WIN32)
+    ULONG highest = 0;
+    if (GetNumaHighestNodeNumber(&highest))
+    {
+        for (USHORT id = 0; id <= highest; id++)
+        {
+            NumaNode node;
+            if (!GetNumaNodeProcessorMaskEx(id, &node.affinity) || node.affinity.Mask == 0)
+            {
+                continue;
+            }
+            for (int cpu = 0; cpu < int(sizeof(KAFFINITY) * 8); cpu++)
+            {
+                if (node.affinity.Mask & (KAFFINITY(1) << cpu))
+                {
+                    node.cpus.push_back(cpu);
+                }
+            }
+            nodes.push_back(node);
+        }
+    }
+#endif
+    if (nodes.empty())
+    {
+        NumaNode node;
+        for (int cpu = 0; cpu < int(std::max(1u, std::thread::hardware_concurrency())); cpu++)
+        {
+            node.cpus.push_back(cpu);
+        }
+        nodes.push_back(node);
+    }
+    return nodes;
+}
+static const std::vector<NumaNode>& Nodes()
+{
+    static const std::vector<NumaNode> nodes = discoverNodes();
+    return nodes;
+}
+
+int NumaNodeCount()
+{
+    return static_cast<int>(Nodes().size());
+}
+//fills the cpus of one node before moving to the next, so small thread counts stay on a single socket
+int NumaNodeForThread(int id)
+{
+    const std::vector<NumaNode>& nodes = Nodes();
+    size_t total = 0;
+    for (const NumaNode& node : nodes)
+    {
+        total += node.cpus.size();
+    }
+    size_t slot = static_cast<size_t>(id) % total;
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        if (slot < nodes[i].cpus.size())
+        {
+            return static_cast<int>(i);
+        }
+        slot -= nodes[i].cpus.size();
+    }
+    return 0;
+}
+//lets the calling thread run on any cpu of the node, the scheduler still balances inside it
+bool PinThreadToNode(int node)
+{
+    const std::vector<NumaNode>& nodes = Nodes();
+    if (node < 0 || node >= int(nodes.size()))
+    {
+        return false;
+    }
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : nodes[node].cpus)
+    {
+        CPU_SET(cpu, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#elif defined(_WIN32)
+    GROUP_AFFINITY affinity = nodes[node].affinity;
+    return SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) != 0;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+//NUMA topology read from the OS, a machine without it is reported as a single node
+int NumaNodeCount();
+int NumaNodeForThread(int id);
+bool PinThreadToNode(int node);
@@ -8,7 +8,6 @@
 #include "Search.h"
 #include "Transpositions.h"
 #include "Tuneables.h"
-#include <algorithm>
 #include <utility>
 
 bool IsMoveNoisy(Move& move)
@@ -31,69 +30,64 @@ bool IsEpCapture(Move& move)
     return (move.Type == ep_capture);
 }
 
-int GetMoveScore(Move& move, Board& board, ThreadData& data, TranspositionEntry& entry, uint64_t threat)
+static int CaptureHistScore(Move& move, Board& board, ThreadData& data)
 {
-    //TT move
-    if (board.zobristKey == entry.zobristKey && compareMoves(move, entry.bestMove))
+    int victim = IsEpCapture(move) ? P : get_piece(board.mailbox[move.To], White);
+    int coloredVictim = get_piece(victim, 1 - board.side);
+    return data.histories.captureHistory[move.Piece][move.To][coloredVictim];
+}
+
+MovePicker::MovePicker(Board& board, ThreadData& data, TranspositionEntry& entry, uint64_t threats) :
+        board(board), data(data), masks(GetMoveGenMasks(board)), threats(threats)
+{
+    useTTMove(entry);
+
+    //killers are quiet moves from a sibling node, so they have to be checked against this position as well
+    Move candidate = data.killerMoves[data.ply];
+    if (candidate != Move(0, 0, 0, 0) && candidate != ttMove && !IsMoveCapture(candidate)
+        && IsPseudoLegal(board, candidate) && IsMoveLegal(board, candidate, masks))
     {
-        return 900000000;
+        killer = candidate;
     }
-    else if (IsMoveCapture(move))
+}
+MovePicker::MovePicker(Board& board, ThreadData& data, TranspositionEntry& entry) :
+        board(board), data(data), masks(GetMoveGenMasks(board)), qsearch(true)
+{
+    useTTMove(entry);
+    if (!IsMoveNoisy(ttMove))
     {
-        int attacker = get_piece(move.Piece, White);
-
-        int victim = IsEpCapture(move) ? P : get_piece(board.mailbox[move.To], White);
-        int attackerValue = *SEEPieceValues[attacker];
-        int victimValue = *SEEPieceValues[victim];
-        int coloredVictim = get_piece(victim, 1 - board.side);
-
-        int mvvlvaValue = victimValue * 100 - attackerValue;
-        int histScore = data.histories.captureHistory[move.Piece][move.To][coloredVictim];
-        int seeValue = SEE(board, move, PVS_SEE_ORDERING - histScore / 128) ? 200000 : -1000000;
-
-        int recaptureBonus = 0;
-        if (data.ply >= 1)
-        {
-            int prevMoveTarget = data.searchStack[data.ply - 1].move.To;
-            recaptureBonus = (move.To == prevMoveTarget) ? 100000 : 0;
-        }
-
-        return mvvlvaValue + seeValue + histScore + recaptureBonus;
+        ttMove = Move(0, 0, 0, 0);
     }
-    else if (data.killerMoves[data.ply] == move)
+}
+void MovePicker::useTTMove(TranspositionEntry& entry)
+{
+    if (!entry.matches(board.zobristKey))
     {
-        return 20000;
+        return;
     }
-    else
+    //the entry only keeps 16 bits of the move, the moving piece comes from the board
+    Move16 stored = entry.bestMove;
+    Move candidate = Move(stored.from(), stored.to(), stored.type(), board.mailbox[stored.from()]);
+    if (IsPseudoLegal(board, candidate) && IsMoveLegal(board, candidate, masks))
     {
-        bool fromThreat = Get_bit(threat, move.From);
-        bool toThreat = Get_bit(threat, move.To);
-
-        int mainHistValue = data.histories.mainHist[board.side][move.From][move.To][fromThreat][toThreat];
-        int contHistValue = GetContHistScore(move, data);
-
-        int historyScore = mainHistValue + contHistValue;
-
-        //quiet move max value = 16384
-        //order quiets based on history scores
-        return historyScore - MAX_HISTORY - MAX_CONTHIST;
+        ttMove = candidate;
     }
 }
-
-int QsearchGetMoveScore(Move& move, Board& board, ThreadData& data)
+void MovePicker::scoreNoisy()
 {
-    if (IsMoveCapture(move))
+    for (int i = 0; i < moves.count; ++i)
     {
+        Move& move = moves.moves[i];
+        if (!IsMoveCapture(move))
+        {
+            //promotions without a capture go after every capture that keeps its material
+            scores[i] = -90000;
+            continue;
+        }
         int attacker = get_piece(move.Piece, White);
-
         int victim = IsEpCapture(move) ? P : get_piece(board.mailbox[move.To], White);
-        int attackerValue = *SEEPieceValues[attacker];
-        int victimValue = *SEEPieceValues[victim];
-        int coloredVictim = get_piece(victim, 1 - board.side);
+        int mvvlvaValue = *SEEPieceValues[victim] * 100 - *SEEPieceValues[attacker];
 
-        int mvvlvaValue = victimValue * 100 - attackerValue;
-        int histScore = data.histories.captureHistory[move.Piece][move.To][coloredVictim];
-        int seeValue = SEE(board, move, QS_SEE_ORDERING) ? 0 : -1000000;
         int recaptureBonus = 0;
         if (data.ply >= 1)
         {
@@ -101,66 +95,136 @@ int QsearchGetMoveScore(Move& move, Board& board, ThreadData& data)
             recaptureBonus = (move.To == prevMoveTarget) ? 100000 : 0;
         }
 
-        return mvvlvaValue + histScore + seeValue + recaptureBonus;
+        scores[i] = mvvlvaValue + CaptureHistScore(move, board, data) + recaptureBonus;
     }
-    else
+}
+void MovePicker::scoreQuiets()
+{
+    for (int i = 0; i < moves.count; ++i)
     {
-        return -90000;
+        Move& move = moves.moves[i];
+        bool fromThreat = Get_bit(threats, move.From);
+        bool toThreat = Get_bit(threats, move.To);
+
+        int mainHistValue = data.histories.mainHist[board.side][move.From][move.To][fromThreat][toThreat];
+        int contHistValue = GetContHistScore(move, data);
+
+        //order quiets based on history scores
+        scores[i] = mainHistValue + contHistValue;
     }
 }
-void ChooseNextMove(ScoredMove* scored, MoveList& ml, int moveCount)
+//partial selection sort, only as many moves get sorted as the search asks for
+void MovePicker::selectBest(int index)
 {
-    int bestIndex = moveCount;
-    int bestScore = scored[moveCount].score;
-    for (int i = moveCount + 1; i < ml.count; i++)
+    int bestIndex = index;
+    for (int i = index + 1; i < moves.count; i++)
     {
-        if (scored[i].score > bestScore)
+        if (scores[i] > scores[bestIndex])
         {
             bestIndex = i;
-            bestScore = scored[i].score;
         }
     }
-    if (bestIndex != moveCount)
+    if (bestIndex != index)
     {
-        std::swap(scored[bestIndex], scored[moveCount]);
-        std::swap(ml.moves[bestIndex], ml.moves[moveCount]);
+        std::swap(scores[bestIndex], scores[index]);
+        std::swap(moves.moves[bestIndex], moves.moves[index]);
     }
 }
-
-void ScoreMoves(
-    ScoredMove* scored,
-    MoveList& ml,
-    Board& board,
-    ThreadData& data,
-    TranspositionEntry& entry,
-    uint64_t threats
-)
+bool MovePicker::next(Move& move)
 {
-    for (int i = 0; i < ml.count; ++i)
+    while (true)
     {
-        scored[i].score = GetMoveScore(ml.moves[i], board, data, entry, threats);
-        scored[i].move = ml.moves[i];
+        switch (stage)
+        {
+            case PICK_TT_MOVE:
+                stage = PICK_GEN_CAPTURES;
+                if (ttMove != Move(0, 0, 0, 0))
+                {
+                    move = ttMove;
+                    return true;
+                }
+                break;
+
+            case PICK_GEN_CAPTURES:
+                GenerateLegalMoves(moves, board, qsearch ? GEN_NOISY : GEN_CAPTURES, masks);
+                scoreNoisy();
+                current = 0;
+                stage = PICK_GOOD_CAPTURES;
+                break;
+
+            case PICK_GOOD_CAPTURES:
+                while (current < moves.count)
+                {
+                    selectBest(current);
+                    Move candidate = moves.moves[current++];
+                    if (candidate == ttMove)
+                    {
+                        continue;
+                    }
+                    //the exchange is only worked out for captures the search actually gets to
+                    if (IsMoveCapture(candidate))
+                    {
+                        int threshold = qsearch ? (int)QS_SEE_ORDERING
+                                                : PVS_SEE_ORDERING - CaptureHistScore(candidate, board, data) / 128;
+                        if (!SEE(board, candidate, threshold))
+                        {
+                            badCaptures.add(candidate);
+                            continue;
+                        }
+                    }
+                    move = candidate;
+                    return true;
+                }
+                stage = qsearch ? PICK_BAD_CAPTURES : PICK_KILLER;
+                break;
+
+            case PICK_KILLER:
+                stage = PICK_GEN_QUIETS;
+                if (!skipQuiets && killer != Move(0, 0, 0, 0))
+                {
+                    move = killer;
+                    return true;
+                }
+                break;
+
+            case PICK_GEN_QUIETS:
+                if (skipQuiets)
+                {
+                    stage = PICK_BAD_CAPTURES;
+                    break;
+                }
+                GenerateLegalMoves(moves, board, GEN_PROMOTIONS | GEN_QUIETS, masks);
+                scoreQuiets();
+                current = 0;
+                stage = PICK_QUIETS;
+                break;
+
+            case PICK_QUIETS:
+                while (!skipQuiets && current < moves.count)
+                {
+                    selectBest(current);
+                    Move candidate = moves.moves[current++];
+                    if (candidate == ttMove || candidate == killer)
+                    {
+                        continue;
+                    }
+                    move = candidate;
+                    return true;
+                }
+                stage = PICK_BAD_CAPTURES;
+                break;
+
+            case PICK_BAD_CAPTURES:
+                if (badCurrent < badCaptures.count)
+                {
+                    move = badCaptures.moves[badCurrent++];
+                    return true;
+                }
+                stage = PICK_DONE;
+                break;
+
+            default:
+                return false;
+        }
     }
 }
-
-void SortNoisyMoves(MoveList& ml, Board& board, ThreadData& data)
-{
-    ScoredMove scored[256];
-
-    for (int i = 0; i < ml.count; ++i)
-    {
-        scored[i].score = QsearchGetMoveScore(ml.moves[i], board, data);
-        scored[i].move = ml.moves[i];
-    }
-
-    std::stable_sort(
-        scored,
-        scored + ml.count,
-        [](const ScoredMove& a, const ScoredMove& b) { return a.score > b.score; }
-    );
-
-    for (int i = 0; i < ml.count; ++i)
-    {
-        ml.moves[i] = scored[i].move;
-    }
-}
\ No newline at end of file
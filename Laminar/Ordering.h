@@ -3,24 +3,53 @@
 #include "Movegen.h"
 #include "Search.h"
 #include "Transpositions.h"
-struct ScoredMove
-{
-    int score;
-    Move move;
-};
-void ChooseNextMove(ScoredMove* scored, MoveList& ml, int moveCount);
 bool IsMoveCapture(Move& move);
 bool IsMoveQuiet(Move& move);
 bool IsEpCapture(Move& move);
 bool IsMoveNoisy(Move& move);
 
-void ScoreMoves(
-    ScoredMove* scored,
-    MoveList& ml,
-    Board& board,
-    ThreadData& data,
-    TranspositionEntry& entry,
-    uint64_t threats
-);
-void SortNoisyMoves(MoveList& ml, Board& board, ThreadData& data);
+//stages of a MovePicker, a stage only does its work once every earlier one failed to cut the node off
+enum MovePickStage
+{
+    PICK_TT_MOVE,
+    PICK_GEN_CAPTURES,
+    PICK_GOOD_CAPTURES,
+    PICK_KILLER,
+    PICK_GEN_QUIETS,
+    PICK_QUIETS,
+    PICK_BAD_CAPTURES,
+    PICK_DONE
+};
 
+//hands out the legal moves of a node best first, generating and scoring them only as far as the search gets
+struct MovePicker
+{
+    Board& board;
+    ThreadData& data;
+    MoveGenMasks masks;
+    uint64_t threats = 0ULL;
+    Move ttMove = Move(0, 0, 0, 0);
+    Move killer = Move(0, 0, 0, 0);
+    //quiescence search: captures and promotions only, without the killer and quiet stages
+    bool qsearch = false;
+    //set by the search once late move pruning has given up on quiet moves
+    bool skipQuiets = false;
+    int stage = PICK_TT_MOVE;
+
+    MoveList moves;
+    int scores[256];
+    int current = 0;
+    //captures that lost material once their exchange was worked out, tried after the quiets
+    MoveList badCaptures;
+    int badCurrent = 0;
+
+    MovePicker(Board& board, ThreadData& data, TranspositionEntry& entry, uint64_t threats);
+    MovePicker(Board& board, ThreadData& data, TranspositionEntry& entry);
+    bool next(Move& move);
+
+private:
+    void useTTMove(TranspositionEntry& entry);
+    void scoreNoisy();
+    void scoreQuiets();
+    void selectBest(int index);
+};
@@ -62,13 +62,14 @@ void resetColor()
 {
     std::cout << "\033[0m";
 }
-void printPretty(int score, int64_t elapsedMS, float nps, ThreadData& data, int64_t nodes)
+void printPretty(int64_t elapsedMS, const SearchStats& stats, const ThreadData& data)
 {
+    int score = data.completedScore;
     std::cout << color::white;
     std::cout << std::right;
-    std::cout << color::bright_blue << std::setw(3) << data.currDepth;
+    std::cout << color::bright_blue << std::setw(3) << data.completedDepth;
     std::cout << std::left;
-    std::cout << color::white << " / " << color::bright_green << std::setw(5) << data.selDepth;
+    std::cout << color::white << " / " << color::bright_green << std::setw(5) << stats.selDepth;
     std::cout << color::white;
     if (std::abs(score) >= MATESCORE - MAXPLY)
     {
@@ -92,22 +93,22 @@ void printPretty(int score, int64_t elapsedMS, float nps, ThreadData& data, int6
     int hashfull = get_hashfull();
     std::cout << color::bright_blue << std::right << std::setw(5) << static_cast<int>(std::round(elapsedMS))
               << color::white << " ms    ";
-    std::cout << color::bright_blue << std::right << std::setw(8) << nodes << color::white << " nodes       ";
-    std::cout << color::bright_blue << std::right << std::setw(8) << static_cast<int>(std::round(nps)) << color::white
-              << " nodes/sec      ";
+    std::cout << color::bright_blue << std::right << std::setw(8) << stats.nodes << color::white << " nodes       ";
+    std::cout << color::bright_blue << std::right << std::setw(8) << static_cast<int>(std::round(stats.nps(elapsedMS)))
+              << color::white << " nodes/sec      ";
     std::cout << color::bright_blue << std::right << std::setw(5) << (hashfull) / 10 << color::white << " % TT     ";
     /*std::cout << " time " << () << " nodes " << data.searchNodeCount << " nps "
               << static_cast<int>(std::round(nps)) << " hashfull " << hashfull << " pv " << std::flush;*/
     std::cout << "\n";
     std::cout << "PV: ";
-    for (int count = 0; count < data.pvLengths[0]; count++)
+    for (int count = 0; count < data.completedPvLength; count++)
     {
         int brightness = 255 - (count * (255 - 128) / 16);
         if (brightness < 128)
             brightness = 128;
         std::cout << "\033[38;2;" << brightness << ";" << brightness << ";" << brightness << "m";
 
-        printMove(data.pvTable[0][count]);
+        printMove(data.completedPv[count]);
         std::cout << " ";
     }
 
@@ -22,4 +22,4 @@ namespace color
 
 } // namespace color
 
-void printPretty(int score, int64_t elapsedMS, float nps, ThreadData& data, int64_t nodes);
+void printPretty(int64_t elapsedMS, const SearchStats& stats, const ThreadData& data);
@@ -0,0 +1,138 @@
+#include "Repetition.h"
+#include "Bit.h"
+#include "Const.h"
+#include "Movegen.h"
+#include <algorithm>
+#include <utility>
+
+extern uint64_t piece_keys[12][64];
+extern uint64_t knight_attacks[64];
+extern uint64_t king_attacks[64];
+
+uint64_t CuckooKeys[CUCKOO_SIZE];
+uint16_t CuckooMoves[CUCKOO_SIZE];
+
+static uint64_t EmptyBoardAttacks(int piece, int square)
+{
+    switch (get_piece(piece, White))
+    {
+        case N:
+            return knight_attacks[square];
+        case B:
+            return get_bishop_attacks(square, 0ULL);
+        case R:
+            return get_rook_attacks(square, 0ULL);
+        case Q:
+            return get_queen_attacks(square, 0ULL);
+        default:
+            return king_attacks[square];
+    }
+}
+//needs the slider attack tables and the zobrist keys to be initialized first
+void InitCuckooTables()
+{
+    for (int i = 0; i < CUCKOO_SIZE; i++)
+    {
+        CuckooKeys[i] = 0ULL;
+        CuckooMoves[i] = 0;
+    }
+
+    for (int piece = P; piece <= k; piece++)
+    {
+        if (piece == P || piece == p)
+        {
+            continue;
+        }
+        for (int s1 = 0; s1 < 64; s1++)
+        {
+            for (int s2 = s1 + 1; s2 < 64; s2++)
+            {
+                if (!(EmptyBoardAttacks(piece, s1) & (1ULL << s2)))
+                {
+                    continue;
+                }
+                //moves are stored as from | to << 6, s2 > s1 keeps every real move nonzero
+                uint16_t move = s1 | (s2 << 6);
+                uint64_t key = piece_keys[piece][s1] ^ piece_keys[piece][s2] ^ side_key;
+                int slot = cuckooH1(key);
+                while (true)
+                {
+                    std::swap(CuckooKeys[slot], key);
+                    std::swap(CuckooMoves[slot], move);
+                    if (move == 0)
+                    {
+                        break;
+                    }
+                    slot = slot == cuckooH1(key) ? cuckooH2(key) : cuckooH1(key);
+                }
+            }
+        }
+    }
+}
+//how far back a repetition can reach, neither an irreversible move nor a null move can be repeated across
+static inline int RepetitionWindow(const Board& board)
+{
+    return std::min<int>(board.halfmove, board.pliesFromNull);
+}
+//a position seen before since the last irreversible move counts as a draw,
+//only positions with the same side to move can match so step back two plies at a time
+bool IsRepetition(const Board& board, const KeyStack& keys)
+{
+    int current = keys.size() - 1;
+    int first = current - RepetitionWindow(board);
+    for (int i = current - 4; i >= first; i -= 2)
+    {
+        if (keys[i] == board.zobristKey)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+//true if the side to move has a reversible move that reaches a position already seen inside the search,
+//so the node is worth at least a draw
+bool HasUpcomingRepetition(const Board& board, const KeyStack& keys, int ply)
+{
+    int current = keys.size() - 1;
+    int end = RepetitionWindow(board);
+    if (end < 3)
+    {
+        return false;
+    }
+
+    uint64_t originalKey = board.zobristKey;
+    //xor of the opponent's moves in between, zero when they undid themselves
+    uint64_t other = originalKey ^ keys[current - 1] ^ side_key;
+
+    for (int i = 3; i <= end; i += 2)
+    {
+        other ^= keys[current - i + 1] ^ keys[current - i] ^ side_key;
+        if (other != 0)
+        {
+            continue;
+        }
+
+        uint64_t moveKey = originalKey ^ keys[current - i];
+        int slot = cuckooH1(moveKey);
+        if (CuckooKeys[slot] != moveKey)
+        {
+            slot = cuckooH2(moveKey);
+            if (CuckooKeys[slot] != moveKey)
+            {
+                continue;
+            }
+        }
+
+        int from = CuckooMoves[slot] & 63;
+        int to = CuckooMoves[slot] >> 6;
+        if (!(BetweenSquares[from][to] & board.occupancies[Both]))
+        {
+            //a position from before the root is only a draw if it already happened twice, so stay inside the search
+            if (ply > i)
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
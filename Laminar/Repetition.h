@@ -0,0 +1,23 @@
+#pragma once
+#include "Board.h"
+#include <cstdint>
+
+//cuckoo tables of every reversible non-pawn move, keyed by the zobrist difference it makes,
+//after Marcel van Kervinck's scheme for detecting that a position can be repeated in one move
+constexpr int CUCKOO_SIZE = 8192;
+
+extern uint64_t CuckooKeys[CUCKOO_SIZE];
+extern uint16_t CuckooMoves[CUCKOO_SIZE];
+
+inline int cuckooH1(uint64_t key)
+{
+    return key & (CUCKOO_SIZE - 1);
+}
+inline int cuckooH2(uint64_t key)
+{
+    return (key >> 16) & (CUCKOO_SIZE - 1);
+}
+
+void InitCuckooTables();
+bool IsRepetition(const Board& board, const KeyStack& keys);
+bool HasUpcomingRepetition(const Board& board, const KeyStack& keys, int ply);
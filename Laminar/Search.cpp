@@ -1,4 +1,5 @@
 #include "Search.h"
+#include "Abdada.h"
 #include "Bit.h"
 #include "Board.h"
 #include "Const.h"
@@ -8,6 +9,7 @@
 #include "NNUE.h"
 #include "Ordering.h"
 #include "PrettyPrinting.h"
+#include "Repetition.h"
 #include "SEE.h"
 #include "Transpositions.h"
 #include "Tuneables.h"
@@ -17,6 +19,7 @@
 #include <cstring>
 #include <iostream>
 #include <limits>
+#include <unordered_map>
 #ifndef EVALFILE
     #define EVALFILE "./nnue.bin"
 #endif
@@ -27,7 +30,8 @@
 bool IsUCI = false;
 int lmrTable[MAXPLY][256];
 
-bool stopSearch = false;
+//raised once by whoever ends the search, every thread polls it at each node
+std::atomic<bool> stopSearch{false};
 
 void InitializeLMRTable()
 {
@@ -46,48 +50,30 @@ void InitializeSearch(ThreadData& data)
     memset(&data.histories, 0, sizeof(data.histories));
     memset(&data.killerMoves, 0, sizeof(data.killerMoves));
     memset(&data.searchStack, 0, sizeof(data.searchStack));
+    data.evalCache.resize(EvalCacheSize);
 }
 
 void InitNNUE()
 {
-    LoadNetwork(EVALFILE);
-}
-
-bool IsThreefold(std::vector<uint64_t>& history_table, int last_irreversible)
-{
-    uint64_t lastmove = history_table[history_table.size() - 1];
-
-    int repetition_count = 1;
-    for (int i = history_table.size() - 2; i > last_irreversible; i--)
+    //keep a net chosen with setoption EvalFile across ucinewgame
+    if (EvalNetwork.weights == nullptr)
     {
-        if (i < 0)
-            break;
-
-        if (history_table[i] == lastmove)
-        {
-            repetition_count++;
-        }
-
-        if (repetition_count >= 2)
-        {
-            return true;
-        }
+        LoadDefaultNetwork();
     }
-    return false;
 }
 
 bool isInsufficientMaterial(const Board& board)
 {
-    int whiteBishops = count_bits(board.bitboards[B]);
-    int blackBishops = count_bits(board.bitboards[b]);
-    int whiteKnights = count_bits(board.bitboards[N]);
-    int blackKnights = count_bits(board.bitboards[n]);
-    int whiteRooks = count_bits(board.bitboards[R]);
-    int blackRooks = count_bits(board.bitboards[r]);
-    int whiteQueens = count_bits(board.bitboards[Q]);
-    int blackQueens = count_bits(board.bitboards[q]);
-    int whitePawns = count_bits(board.bitboards[P]);
-    int blackPawns = count_bits(board.bitboards[p]);
+    int whiteBishops = board.pieceCounts[B];
+    int blackBishops = board.pieceCounts[b];
+    int whiteKnights = board.pieceCounts[N];
+    int blackKnights = board.pieceCounts[n];
+    int whiteRooks = board.pieceCounts[R];
+    int blackRooks = board.pieceCounts[r];
+    int whiteQueens = board.pieceCounts[Q];
+    int blackQueens = board.pieceCounts[q];
+    int whitePawns = board.pieceCounts[P];
+    int blackPawns = board.pieceCounts[p];
     if (whiteQueens == 0 && blackQueens == 0 && whiteRooks == 0 && blackRooks == 0 && whitePawns == 0
         && blackPawns == 0)
     {
@@ -120,42 +106,6 @@ bool isInsufficientMaterial(const Board& board)
     return false;
 }
 
-inline void refresh_if_cross(Move& move, Board& board)
-{
-    if (get_piece(move.Piece, White) == K) //king has moved
-    {
-        if (getFile(move.From) <= 3) //king was left before
-        {
-            if (getFile(move.To) >= 4) //king moved to right
-            {
-                //fully refresh the stm accumulator, and change that to start mirroring
-                if (board.side == White)
-                {
-                    resetWhiteAccumulator(board, board.accumulator, true);
-                }
-                else
-                {
-                    resetBlackAccumulator(board, board.accumulator, true);
-                }
-            }
-        }
-        else //king was right before
-        {
-            if (getFile(move.To) <= 3) //king moved to left
-            {
-                //fully refresh the stm accumulator, and change that to stop mirroring
-                if (board.side == White)
-                {
-                    resetWhiteAccumulator(board, board.accumulator, false);
-                }
-                else
-                {
-                    resetBlackAccumulator(board, board.accumulator, false);
-                }
-            }
-        }
-    }
-}
 inline void SaveCopyMakeInfo(Board& board, Move& move, CopyMake& info)
 {
     info.lastEp = board.enpassent;
@@ -166,54 +116,52 @@ inline void SaveCopyMakeInfo(Board& board, Move& move, CopyMake& info)
     info.last_white_np = board.whiteNonPawnKey;
     info.last_black_np = board.blackNonPawnKey;
     info.last_minor = board.minorKey;
-    info.last_irreversible = board.lastIrreversiblePly;
+    info.last_pliesFromNull = board.pliesFromNull;
     info.last_halfmove = board.halfmove;
     info.last_zobrist = board.zobristKey;
+    info.last_checkers = board.checkers;
+    info.last_pinned = board.pinned;
+    info.last_threats = board.threats;
 }
-inline void ApplyCopyMake(Board& board, CopyMake& info, ThreadData& data, int ply)
+inline void ApplyCopyMake(Board& board, CopyMake& info)
 {
     board.enpassent = info.lastEp;
     board.castle = info.lastCastle;
     board.side = info.lastside;
     board.zobristKey = info.last_zobrist;
-    board.accumulator = data.searchStack[ply].last_accumulator;
     board.pawnKey = info.last_pawnKey;
     board.whiteNonPawnKey = info.last_white_np;
     board.blackNonPawnKey = info.last_black_np;
     board.minorKey = info.last_minor;
-    board.lastIrreversiblePly = info.last_irreversible;
+    board.pliesFromNull = info.last_pliesFromNull;
     board.halfmove = info.last_halfmove;
+    board.checkers = info.last_checkers;
+    board.pinned = info.last_pinned;
+    board.threats = info.last_threats;
 }
 inline int QuiescentSearch(Board& board, ThreadData& data, int alpha, int beta)
 {
     //only search "noisy" moves (captures, promos) to only evaluate quiet positions
-    if (data.stopSearch.load())
+    //time limits are raised by the stop timer, only the node limit is counted here to keep it exact
+    if (stopSearch.load(std::memory_order_relaxed))
     {
         return 0;
     }
-    if (data.ply != 0 && data.searchNodeCount % 1024 == 0)
+    if (data.ply != 0 && data.hardNodeBound != -1 && data.hardNodeBound <= data.counters.nodes.get())
     {
-        auto now = std::chrono::steady_clock::now();
-        int64_t elapsedMS = std::chrono::duration_cast<std::chrono::milliseconds>(now - data.clockStart).count();
-        if (elapsedMS > data.SearchTime || (data.hardNodeBound != -1 && data.hardNodeBound <= data.searchNodeCount))
-        {
-            data.stopSearch.store(true);
-            return 0;
-        }
+        stopSearch.store(true, std::memory_order_relaxed);
+        return 0;
     }
     bool isPvNode = beta - alpha > 1;
-
-    int rawEval = Evaluate(board);
-    int staticEval = AdjustEvalWithCorrHist(board, rawEval, data);
     int currentPly = data.ply;
 
-    data.searchStack[currentPly].staticEval = staticEval;
-    data.selDepth = std::max(currentPly, data.selDepth);
+    data.counters.selDepth.raise(currentPly);
 
+    //probe before evaluating so a cutoff never pays for the network
     bool ttHit = false;
     TranspositionEntry ttEntry = ttLookUp(board.zobristKey);
     int ttBound = unpackBound(ttEntry.packedInfo);
-    if (ttEntry.zobristKey == board.zobristKey && ttBound != HFNONE)
+    if (ttEntry.matches(board.zobristKey))
     {
         ttHit = true;
         bool ExactCutoff = (ttBound == HFEXACT);
@@ -226,6 +174,12 @@ inline int QuiescentSearch(Board& board, ThreadData& data, int alpha, int beta)
             return ttEntry.score;
         }
     }
+
+    int rawEval = ttHit && ttEntry.staticEval != EVAL_NONE ? ttEntry.staticEval
+                                                            : Evaluate(board, data.accumulators, data.evalCache);
+    int staticEval = AdjustEvalWithCorrHist(board, rawEval, data);
+
+    data.searchStack[currentPly].staticEval = staticEval;
     if (currentPly >= MAXPLY - 2)
     {
         return staticEval;
@@ -245,25 +199,16 @@ inline int QuiescentSearch(Board& board, ThreadData& data, int alpha, int beta)
         alpha = bestValue;
     }
 
-    MoveList moveList;
-
     Move bestMove;
     uint8_t ttFlag = HFUPPER;
-    GeneratePseudoLegalMoves(moveList, board, true);
-    SortNoisyMoves(moveList, board, data);
+    MovePicker picker(board, data, ttEntry);
 
     int searchedMoves = 0;
 
-    data.searchStack[currentPly].last_accumulator = board.accumulator;
-
     CopyMake undoInfo{};
-    for (int i = 0; i < moveList.count; ++i)
+    Move move;
+    while (picker.next(move))
     {
-        Move& move = moveList.moves[i];
-
-        if (!IsMoveNoisy(move))
-            continue;
-
         //skip moves that have bad static exchange evaluation score,
         //since they are likely bad
         if (!SEE(board, move, QS_SEE_MARGIN))
@@ -273,29 +218,22 @@ inline int QuiescentSearch(Board& board, ThreadData& data, int alpha, int beta)
 
         prefetchTT(zobristAfterMove(board, move));
         SaveCopyMakeInfo(board, move, undoInfo);
-        refresh_if_cross(move, board);
         MakeMove(board, move);
+        data.accumulators.push(board);
+        data.keys.push_back(board.zobristKey);
 
         data.ply++;
 
-        if (!isLegal(move, board))
-        {
-            UnmakeMove(board, move, undoInfo.captured_piece);
-            ApplyCopyMake(board, undoInfo, data, currentPly);
-            board.history.pop_back();
-            data.ply--;
-
-            continue;
-        }
         searchedMoves++;
-        data.searchNodeCount++;
+        data.counters.nodes.add();
         data.searchStack[currentPly].move = move;
 
         score = -QuiescentSearch(board, data, -beta, -alpha);
 
         UnmakeMove(board, move, undoInfo.captured_piece);
-        ApplyCopyMake(board, undoInfo, data, currentPly);
-        board.history.pop_back();
+        ApplyCopyMake(board, undoInfo);
+        data.accumulators.pop();
+        data.keys.pop_back();
         data.ply--;
 
         bestValue = std::max(score, bestValue);
@@ -315,11 +253,11 @@ inline int QuiescentSearch(Board& board, ThreadData& data, int alpha, int beta)
     //to use later for qs search or tt adjusted eval
     ttEntry.score = bestValue;
     ttEntry.bestMove = Move16(bestMove.From, bestMove.To, bestMove.Type);
-    ttEntry.zobristKey = board.zobristKey;
     ttEntry.packedInfo = packData(0, ttFlag, false);
+    ttEntry.staticEval = packEval(rawEval);
     if (ttBound == HFNONE)
     {
-        ttStore(ttEntry, board);
+        ttStore(ttEntry, board.zobristKey);
     }
     if (searchedMoves == 0)
     {
@@ -347,19 +285,14 @@ inline int AlphaBeta(
     data.pvLengths[data.ply] = 0;
 
     bool isSingularSearch = excludedMove != NULLMOVE;
-    if (data.stopSearch.load())
+    if (stopSearch.load(std::memory_order_relaxed))
     {
         return 0;
     }
-    if (data.ply != 0 && data.searchNodeCount % 1024 == 0)
+    if (data.ply != 0 && data.hardNodeBound != -1 && data.hardNodeBound <= data.counters.nodes.get())
     {
-        auto now = std::chrono::steady_clock::now();
-        int64_t elapsedMS = std::chrono::duration_cast<std::chrono::milliseconds>(now - data.clockStart).count();
-        if (elapsedMS > data.SearchTime || (data.hardNodeBound != -1 && data.hardNodeBound <= data.searchNodeCount))
-        {
-            data.stopSearch.store(true);
-            return 0;
-        }
+        stopSearch.store(true, std::memory_order_relaxed);
+        return 0;
     }
 
     bool isPvNode = beta - alpha > 1;
@@ -369,7 +302,7 @@ inline int AlphaBeta(
 
     if (!root)
     {
-        if (IsThreefold(board.history, board.lastIrreversiblePly))
+        if (IsRepetition(board, data.keys))
         {
             return 0;
         }
@@ -381,9 +314,18 @@ inline int AlphaBeta(
         {
             return 0;
         }
+        //we can force a repetition with our next move, so this node is worth at least a draw
+        if (alpha < 0 && HasUpcomingRepetition(board, data.keys, currentPly))
+        {
+            alpha = 0;
+            if (alpha >= beta)
+            {
+                return alpha;
+            }
+        }
     }
 
-    data.selDepth = std::max(currentPly, data.selDepth);
+    data.counters.selDepth.raise(currentPly);
     //std::cout << "update pv length ply " << currentPly << "\n";
 
     int score = 0;
@@ -415,7 +357,7 @@ inline int AlphaBeta(
 
     int ttBound = unpackBound(ttEntry.packedInfo);
     int ttDepth = unpackDepth(ttEntry.packedInfo);
-    if (ttEntry.zobristKey == board.zobristKey && ttBound != HFNONE)
+    if (ttEntry.matches(board.zobristKey))
     {
         ttHit = true;
         bool ExactCutoff = (ttBound == HFEXACT);
@@ -437,7 +379,9 @@ inline int AlphaBeta(
     //checks if the node has been in a pv node in the past
     ttPv |= unpackTtPv(ttEntry.packedInfo);
 
-    int rawEval = Evaluate(board);
+    //reuse the eval stored with the entry instead of running the network again
+    int rawEval = ttHit && ttEntry.staticEval != EVAL_NONE ? ttEntry.staticEval
+                                                            : Evaluate(board, data.accumulators, data.evalCache);
     int staticEval = AdjustEvalWithCorrHist(board, rawEval, data);
     int ttAdjustedEval = staticEval;
 
@@ -498,10 +442,15 @@ inline int AlphaBeta(
         {
             int lastEp = board.enpassent;
             uint64_t last_zobrist = board.zobristKey;
+            int lastPliesFromNull = board.pliesFromNull;
+            uint64_t lastCheckers = board.checkers;
+            uint64_t lastPinned = board.pinned;
+            uint64_t lastThreats = board.threats;
 
             data.ply++;
             prefetchTT(board.zobristKey ^ side_key);
             MakeNullMove(board);
+            data.keys.push_back(board.zobristKey);
             int reduction = 3;
             reduction += depth / 3;
             reduction += std::min((ttAdjustedEval - beta) / NMP_EVAL_DIVISOR, MAX_NMP_EVAL_R);
@@ -510,8 +459,13 @@ inline int AlphaBeta(
             int score = -AlphaBeta(board, data, depth - reduction, -beta, -beta + 1, !cutnode);
             data.minNmpPly = 0;
             UnmakeNullmove(board);
+            data.keys.pop_back();
             board.enpassent = lastEp;
             board.zobristKey = last_zobrist;
+            board.pliesFromNull = lastPliesFromNull;
+            board.checkers = lastCheckers;
+            board.pinned = lastPinned;
+            board.threats = lastThreats;
             data.ply--;
 
             if (score >= beta)
@@ -530,16 +484,11 @@ inline int AlphaBeta(
             }
         }
     }
-    //Calculate all squares opponent is controlling
-    uint64_t oppThreats = GetAttackedSquares(1 - board.side, board, board.occupancies[Both]);
-
-    MoveList moveList;
-    GeneratePseudoLegalMoves(moveList, board);
-
-    ScoredMove scored[256];
+    //all squares opponent is controlling, worked out when the move leading here was made
+    uint64_t oppThreats = board.threats;
 
     //order moves from best to worse for more cutoff
-    ScoreMoves(scored, moveList, board, data, ttEntry, oppThreats);
+    MovePicker picker(board, data, ttEntry, oppThreats);
 
     MoveList searchedQuietMoves;
     MoveList searchedNoisyMoves;
@@ -553,22 +502,18 @@ inline int AlphaBeta(
     int noisySEEMargin = PVS_NOISY_BASE - PVS_NOISY_MULT * depth * depth;
     int lmpThreshold = (LMP_BASE + (LMP_MULTIPLIER)*depth * depth) / 100;
 
-    bool skipQuiets = false;
-    data.searchStack[currentPly].last_accumulator = board.accumulator;
-
     int materialValue = material_eval(board);
 
     CopyMake undoInfo{};
-    for (int i = 0; i < moveList.count; ++i)
+    Move move;
+    while (picker.next(move))
     {
-        ChooseNextMove(scored, moveList, i);
-        Move& move = moveList.moves[i];
         if (move == excludedMove)
         {
             continue;
         }
         bool isQuiet = !IsMoveCapture(move);
-        if (skipQuiets && isQuiet)
+        if (picker.skipQuiets && isQuiet)
         {
             continue;
         }
@@ -596,7 +541,7 @@ inline int AlphaBeta(
             //because good moves are usually in the front
             if (searchedMoves >= lmpThreshold)
             {
-                skipQuiets = true;
+                picker.skipQuiets = true;
                 continue;
             }
 
@@ -623,20 +568,12 @@ inline int AlphaBeta(
 
         prefetchTT(zobristAfterMove(board, move));
         SaveCopyMakeInfo(board, move, undoInfo);
-        refresh_if_cross(move, board);
         MakeMove(board, move);
+        data.accumulators.push(board);
+        data.keys.push_back(board.zobristKey);
 
         data.ply++;
 
-        if (!isLegal(move, board))
-        {
-            UnmakeMove(board, move, undoInfo.captured_piece);
-            ApplyCopyMake(board, undoInfo, data, currentPly);
-            board.history.pop_back();
-            data.ply--;
-
-            continue;
-        }
         if (isCapture)
         {
             searchedNoisyMoves.add(move);
@@ -647,7 +584,7 @@ inline int AlphaBeta(
             quietMoves++;
         }
         searchedMoves++;
-        data.searchNodeCount++;
+        data.counters.nodes.add();
         data.searchStack[currentPly].move = move;
 
         int reduction = 0;
@@ -660,8 +597,9 @@ inline int AlphaBeta(
             && ttDepth >= depth - 3 && ttBound != HFUPPER && std::abs(ttEntry.score) < MATESCORE - MAXPLY)
         {
             UnmakeMove(board, move, undoInfo.captured_piece);
-            ApplyCopyMake(board, undoInfo, data, currentPly);
-            board.history.pop_back();
+            ApplyCopyMake(board, undoInfo);
+            data.accumulators.pop();
+            data.keys.pop_back();
             data.ply--;
 
             int s_beta = ttEntry.score - depth * 2;
@@ -709,8 +647,9 @@ inline int AlphaBeta(
             {
                 extension = -1;
             }
-            refresh_if_cross(move, board);
             MakeMove(board, move);
+            data.accumulators.push(board);
+            data.keys.push_back(board.zobristKey);
             data.ply++;
         }
         bool doLmr = depth > MIN_LMR_DEPTH && searchedMoves > 1 + root * 2 && !(isPvNode && isCapture);
@@ -759,6 +698,11 @@ inline int AlphaBeta(
             {
                 lmrAdjustments -= EVALPLEXITY_LMR_SUB;
             }
+            //another thread is already on this node, spend less of our time duplicating it
+            if (data.sharedSearch && depth >= ABDADA_MIN_DEPTH && isBeingSearched(board.zobristKey))
+            {
+                lmrAdjustments += ABDADA_LMR_ADD;
+            }
             lmrAdjustments /= 1024;
             reduction += lmrAdjustments;
         }
@@ -776,7 +720,13 @@ inline int AlphaBeta(
 
         int childDepth = depth + extension - 1;
 
-        uint64_t nodesBeforeSearch = data.searchNodeCount;
+        uint64_t nodesBeforeSearch = data.counters.nodes.get();
+        uint64_t childKey = board.zobristKey;
+        bool markChild = data.sharedSearch && depth >= ABDADA_MIN_DEPTH;
+        if (markChild)
+        {
+            markSearching(childKey);
+        }
 
         //Late move reduction
         //do reduced zero window search for late moves
@@ -803,15 +753,20 @@ inline int AlphaBeta(
         {
             score = -AlphaBeta(board, data, childDepth, -beta, -alpha, false);
         }
-        uint64_t nodesAfterSearch = data.searchNodeCount;
+        if (markChild)
+        {
+            unmarkSearching(childKey);
+        }
+        uint64_t nodesAfterSearch = data.counters.nodes.get();
         uint64_t nodesSpent = nodesAfterSearch - nodesBeforeSearch;
         if (root)
         {
             data.nodesPerMove[move.From][move.To] += nodesSpent;
         }
         UnmakeMove(board, move, undoInfo.captured_piece);
-        ApplyCopyMake(board, undoInfo, data, currentPly);
-        board.history.pop_back();
+        ApplyCopyMake(board, undoInfo);
+        data.accumulators.pop();
+        data.keys.pop_back();
         data.ply--;
 
         bestValue = std::max(score, bestValue);
@@ -922,23 +877,37 @@ inline int AlphaBeta(
 
     //store transposition table
     ttEntry.bestMove = Move16(bestMove.From, bestMove.To, bestMove.Type);
-    ttEntry.zobristKey = board.zobristKey;
     ttEntry.score = adjustMateStore(bestValue, data.ply);
     ttEntry.packedInfo = packData(depth, ttFlag, ttPv);
-    if (!isSingularSearch && !data.stopSearch.load())
+    ttEntry.staticEval = packEval(rawEval);
+    if (!isSingularSearch && !stopSearch.load(std::memory_order_relaxed))
     {
-        ttStore(ttEntry, board);
+        ttStore(ttEntry, board.zobristKey);
     }
 
     return bestValue;
 }
 
-void print_UCI(Move& bestmove, int score, int64_t elapsedMS, float nps, ThreadData& data, uint64_t nodes)
+//sums the counters of every search thread, helpers may still be searching while this runs
+SearchStats CollectSearchStats()
+{
+    SearchStats stats;
+    for (auto& worker : threadPool)
+    {
+        const ThreadData& data = *worker->data;
+        stats.nodes += data.counters.nodes.get();
+        stats.selDepth = std::max(stats.selDepth, data.counters.selDepth.get());
+        stats.evalProbes += data.evalCache.probes.get();
+        stats.evalHits += data.evalCache.hits.get();
+    }
+    return stats;
+}
+void print_UCI(int64_t elapsedMS, const SearchStats& stats, const ThreadData& data)
 {
-    bestmove = data.pvTable[0][0];
+    int score = data.completedScore;
     //int hashfull = get_hashfull();
-    std::cout << "info depth " << data.currDepth;
-    std::cout << " seldepth " << data.selDepth;
+    std::cout << "info depth " << data.completedDepth;
+    std::cout << " seldepth " << stats.selDepth;
     if (std::abs(score) > MATESCORE - MAXPLY)
     {
         int mate_ply = 49000 - std::abs(score);
@@ -954,18 +923,76 @@ void print_UCI(Move& bestmove, int score, int64_t elapsedMS, float nps, ThreadDa
         std::cout << " score cp " << score;
     }
     int hashfull = get_hashfull();
-    std::cout << " time " << static_cast<int>(std::round(elapsedMS)) << " nodes " << nodes << " nps "
-              << static_cast<int>(std::round(nps)) << " hashfull " << hashfull << " pv " << std::flush;
+    std::cout << " time " << static_cast<int>(std::round(elapsedMS)) << " nodes " << stats.nodes << " nps "
+              << static_cast<int>(std::round(stats.nps(elapsedMS))) << " hashfull " << hashfull << " pv " << std::flush;
 
-    for (int count = 0; count < data.pvLengths[0]; count++)
+    for (int count = 0; count < data.completedPvLength; count++)
     {
-        printMove(data.pvTable[0][count]);
+        printMove(data.completedPv[count]);
         std::cout << " ";
     }
     std::cout << "\n" << std::flush;
     ;
 }
 
+//every thread votes for its move weighted by its depth and how far its score is above the worst one,
+//a thread that found a mate is trusted over the vote
+static const ThreadData& pickBestThread(const ThreadData& mainData)
+{
+    auto moveKey = [](const ThreadData& data)
+    {
+        const Move& move = data.completedPv[0];
+        return uint32_t(move.From) | uint32_t(move.To) << 8 | uint32_t(move.Type) << 16;
+    };
+    int minScore = mainData.completedScore;
+    for (auto& worker : threadPool)
+    {
+        if (worker->data->completedPvLength > 0)
+        {
+            minScore = std::min(minScore, worker->data->completedScore);
+        }
+    }
+    std::unordered_map<uint32_t, int64_t> votes;
+    for (auto& worker : threadPool)
+    {
+        const ThreadData& candidate = *worker->data;
+        if (candidate.completedPvLength > 0)
+        {
+            votes[moveKey(candidate)] += int64_t(candidate.completedScore - minScore + 14) * candidate.completedDepth;
+        }
+    }
+
+    const ThreadData* best = &mainData;
+    for (auto& worker : threadPool)
+    {
+        const ThreadData& candidate = *worker->data;
+        if (candidate.completedPvLength == 0)
+        {
+            continue;
+        }
+        if (std::abs(best->completedScore) > MATESCORE - MAXPLY)
+        {
+            //quicker mate, or a longer defence against one
+            if (candidate.completedScore > best->completedScore)
+            {
+                best = &candidate;
+            }
+        }
+        else if (candidate.completedScore > MATESCORE - MAXPLY
+                 || (candidate.completedScore > -(MATESCORE - MAXPLY)
+                     && votes[moveKey(candidate)] > votes[moveKey(*best)]))
+        {
+            best = &candidate;
+        }
+    }
+    return *best;
+}
+
+//helpers skip iterations in staggered patterns, so at any moment they are spread over several depths
+//instead of all racing through the same one
+static const int HelperSkipSize[] = {1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4};
+static const int HelperSkipPhase[] = {0, 1, 0, 1, 2, 3, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 6, 7};
+
 std::pair<Move, int> IterativeDeepening(
     Board& board,
     int depth,
@@ -974,27 +1001,32 @@ std::pair<Move, int> IterativeDeepening(
     bool isBench
 )
 {
-    int64_t hardTimeLimit = searchLimits.HardTimeLimit;
-    data.SearchTime = hardTimeLimit != NOLIMIT ? hardTimeLimit : std::numeric_limits<int64_t>::max();
-
-    data.searchNodeCount = 0;
-    data.hardNodeBound = searchLimits.HardNodeLimit;
+    data.counters.nodes.set(0);
     Move bestmove = Move(0, 0, 0, 0);
     data.clockStart = std::chrono::steady_clock::now();
+    data.accumulators.reset(board);
+    data.evalCache.probes.set(0);
+    data.evalCache.hits.set(0);
 
     int score = 0;
     int bestScore = 0;
 
     memset(data.pvTable, 0, sizeof(data.pvTable));
     memset(data.pvLengths, 0, sizeof(data.pvLengths));
+    data.completedDepth = 0;
+    data.completedPvLength = 0;
 
+    //helpers only stop when the main thread does
     if (!data.isMainThread)
     {
-        data.SearchTime = std::numeric_limits<int64_t>::max();
         searchLimits.SoftTimeLimit = NOLIMIT;
         searchLimits.HardTimeLimit = NOLIMIT;
+        searchLimits.HardNodeLimit = NOLIMIT;
     }
+    data.hardNodeBound = searchLimits.HardNodeLimit;
+    data.sharedSearch = !isBench && threadPool.size() > 1;
     bool mainThread = data.isMainThread;
+    bool pondering = mainThread && !isBench && stillPondering(data.clockStart, false);
     double nodesTmScale = 1.0;
 
     //Iterative deepening
@@ -1002,25 +1034,23 @@ std::pair<Move, int> IterativeDeepening(
     //and allow more cutoffs
     for (data.currDepth = 1; data.currDepth <= depth; data.currDepth++)
     {
+        if (!mainThread && data.currDepth > 1)
+        {
+            int pattern = (data.threadId - 1) % 20;
+            if ((data.currDepth + HelperSkipPhase[pattern]) / HelperSkipSize[pattern] % 2 != 0)
+            {
+                continue;
+            }
+        }
         memset(data.pvTable, 0, sizeof(data.pvTable));
         memset(data.pvLengths, 0, sizeof(data.pvLengths));
         memset(data.nodesPerMove, 0, sizeof(data.nodesPerMove));
         data.ply = 0;
-        data.selDepth = 0;
+        data.counters.selDepth.set(0);
         for (int i = 0; i < MAXPLY; i++)
         {
             data.searchStack[i].move = Move(0, 0, 0, 0);
         }
-        //ensure depth 1 search always finishes
-        if (data.currDepth == 1)
-        {
-            data.SearchTime = std::numeric_limits<int64_t>::max();
-        }
-        else
-        {
-            data.SearchTime = hardTimeLimit != NOLIMIT ? hardTimeLimit : std::numeric_limits<int64_t>::max();
-        }
-        //std::cout << data.stopSearch.load(std::memory_order_relaxed);
         int delta = ASP_WINDOW_INITIAL;
         int adjustedAlpha = std::max(-MAXSCORE, score - delta);
         int adjustedBeta = std::min(MAXSCORE, score + delta);
@@ -1030,20 +1060,8 @@ std::pair<Move, int> IterativeDeepening(
         //start with small window and gradually widen to allow more cutoffs
         while (true)
         {
-            auto end = std::chrono::steady_clock::now();
-            int64_t MS = static_cast<int64_t>(
-                std::chrono::duration_cast<std::chrono::milliseconds>(end - data.clockStart).count()
-            );
-            if (data.currDepth != 1 && (searchLimits.HardTimeLimit != NOLIMIT && MS > searchLimits.HardTimeLimit)
-                || data.stopSearch.load())
+            if (stopSearch.load(std::memory_order_relaxed))
             {
-                if (mainThread)
-                {
-                    for (auto& worker : threadPool)
-                    {
-                        worker->data.stopSearch.store(true);
-                    }
-                }
                 break;
             }
 
@@ -1076,77 +1094,119 @@ std::pair<Move, int> IterativeDeepening(
             }
         }
 
+        //time limits only count from the moment the opponent plays the predicted move
+        if (pondering)
+        {
+            pondering = stillPondering(data.clockStart, true);
+        }
         auto end = std::chrono::steady_clock::now();
         int64_t elapsedMS =
             static_cast<int64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(end - data.clockStart).count());
-        float second = (float)(elapsedMS + 1) / 1000;
 
         //Node tm
         //scale soft time bound based on the ratio of nodes spent for searching the best move
         if (data.currDepth >= 6 && searchLimits.SoftTimeLimit != NOLIMIT && searchLimits.HardTimeLimit != NOLIMIT)
         {
-            nodesTmScale = (1.5 - ((double)data.nodesPerMove[bestmove.From][bestmove.To] / data.searchNodeCount)) * 1;
+            double bestMoveNodes = data.nodesPerMove[bestmove.From][bestmove.To];
+            nodesTmScale = (1.5 - (bestMoveNodes / data.counters.nodes.get())) * 1;
         }
 
-        if (!data.stopSearch.load())
+        bool stopped = stopSearch.load(std::memory_order_relaxed);
+        if (!stopped)
         {
             bestmove = data.pvTable[0][0];
             bestScore = score;
+            data.completedDepth = data.currDepth;
+            data.completedScore = score;
+            data.completedPvLength = data.pvLengths[0];
+            memcpy(data.completedPv, data.pvTable[0], sizeof(data.completedPv));
         }
 
-        if (!data.stopSearch.load() && !isBench)
+        if (!stopped && !isBench)
         {
             if (data.isMainThread)
             {
-                int64_t combinedNodeCount = 0;
-                for (auto& worker : threadPool)
-                {
-                    combinedNodeCount += worker->data.searchNodeCount;
-                }
-                float combinedNps = combinedNodeCount / second;
-
+                SearchStats stats = CollectSearchStats();
                 if (IsUCI)
                 {
-                    print_UCI(bestmove, score, elapsedMS, combinedNps, data, combinedNodeCount);
+                    print_UCI(elapsedMS, stats, data);
                 }
                 else
                 {
-                    printPretty(score, elapsedMS, combinedNps, data, combinedNodeCount);
+                    printPretty(elapsedMS, stats, data);
                 }
             }
         }
-        if (data.currDepth != 1 && (searchLimits.HardTimeLimit != NOLIMIT && elapsedMS > searchLimits.HardTimeLimit)
-            || data.stopSearch.load()
-            || (searchLimits.HardNodeLimit != NOLIMIT && data.searchNodeCount > searchLimits.HardNodeLimit))
+        bool hardLimitHit = (searchLimits.HardTimeLimit != NOLIMIT && elapsedMS > searchLimits.HardTimeLimit)
+                         || (searchLimits.HardNodeLimit != NOLIMIT
+                             && data.counters.nodes.get() > searchLimits.HardNodeLimit);
+        bool softLimitHit = data.currDepth != 1 && searchLimits.SoftTimeLimit != NOLIMIT
+                         && elapsedMS > (double)searchLimits.SoftTimeLimit * nodesTmScale;
+        if (stopped || (!pondering && (hardLimitHit || softLimitHit)))
         {
-            if (mainThread)
-            {
-                for (auto& worker : threadPool)
-                {
-                    worker->data.stopSearch.store(true);
-                }
-            }
             break;
         }
-        if (data.currDepth != 1
-                && (searchLimits.SoftTimeLimit != NOLIMIT
-                    && elapsedMS > (double)searchLimits.SoftTimeLimit * nodesTmScale)
-            || data.stopSearch.load())
+        //depth 1 always finishes, the hard limit only applies from here on
+        if (data.currDepth == 1 && mainThread && !isBench && searchLimits.HardTimeLimit != NOLIMIT)
+        {
+            armStopTimer(data.clockStart, searchLimits.HardTimeLimit);
+        }
+    }
+    Move ponderMove = NULLMOVE;
+    if (mainThread && !isBench)
+    {
+        if (pondering)
         {
-            if (mainThread)
+            waitForPonderEnd();
+        }
+        disarmStopTimer();
+        stopSearch.store(true, std::memory_order_relaxed);
+        waitForHelpers();
+
+        //report the voted result if it is not the one the main thread already printed
+        const ThreadData& chosen = pickBestThread(data);
+        if (chosen.completedPvLength > 1)
+        {
+            ponderMove = chosen.completedPv[1];
+        }
+        if (&chosen != &data)
+        {
+            bestmove = chosen.completedPv[0];
+            bestScore = chosen.completedScore;
+
+            auto end = std::chrono::steady_clock::now();
+            int64_t elapsedMS = std::chrono::duration_cast<std::chrono::milliseconds>(end - data.clockStart).count();
+            SearchStats stats = CollectSearchStats();
+            if (IsUCI)
             {
-                for (auto& worker : threadPool)
-                {
-                    worker->data.stopSearch.store(true);
-                }
+                print_UCI(elapsedMS, stats, chosen);
+            }
+            else
+            {
+                printPretty(elapsedMS, stats, chosen);
             }
-            break;
         }
     }
     if (data.isMainThread)
     {
+        //bench reports its own totals, the thread pool's figures belong to the last go
+        if (IsUCI && !isBench)
+        {
+            SearchStats stats = CollectSearchStats();
+            if (stats.evalProbes > 0)
+            {
+                uint64_t permille = stats.evalHits * 1000 / stats.evalProbes;
+                std::cout << "info string evalcache hits " << stats.evalHits << " probes " << stats.evalProbes
+                          << " hitrate " << permille / 10 << "." << permille % 10 << "%\n";
+            }
+        }
         std::cout << "bestmove ";
         printMove(bestmove);
+        if (ponderMove != NULLMOVE)
+        {
+            std::cout << " ponder ";
+            printMove(ponderMove);
+        }
         std::cout << "\n" << std::flush;
     }
 
@@ -1,20 +1,20 @@
 #pragma once
 #include "Board.h"
 #include "Const.h"
+#include "Evaluation.h"
 #include "Movegen.h"
 #include "Transpositions.h"
 #include <atomic>
 #include <chrono>
 #include <cstdint>
 extern bool IsUCI;
-extern bool stopSearch;
+extern std::atomic<bool> stopSearch;
 struct SearchData
 {
     Move move;
     int staticEval = 0;
     int reduction = 0;
     bool check = false;
-    AccumulatorPair last_accumulator;
 };
 
 struct Histories
@@ -38,24 +38,55 @@ struct Histories
     int16_t contHist[12][64][12][64];
 };
 
+//statistics other threads read mid search, kept on a cache line of their own
+struct alignas(64) SearchCounters
+{
+    RelaxedCounter<int64_t> nodes;
+    RelaxedCounter<int> selDepth;
+};
+
+//totals over all search threads, what the info lines report
+struct SearchStats
+{
+    int64_t nodes = 0;
+    int selDepth = 0;
+    uint64_t evalProbes = 0;
+    uint64_t evalHits = 0;
+
+    float nps(int64_t elapsedMS) const
+    {
+        return nodes / ((float)(elapsedMS + 1) / 1000);
+    }
+};
+
 struct alignas(64) ThreadData
 {
     SearchData searchStack[MAXPLY];
+    AccumulatorStack accumulators;
+    //game keys up to the root, then one per ply of the current line
+    KeyStack keys;
+    EvalCache evalCache;
     std::chrono::steady_clock::time_point clockStart;
-    int64_t searchNodeCount = 0;
-    int64_t SearchTime = -1;
     int64_t hardNodeBound = -1;
     uint64_t nodesPerMove[64][64];
     int ply = 0;
     int currDepth = 0;
-    int selDepth = 0;
     int minNmpPly = 0;
     int pvLengths[MAXPLY + 1] = {};
     Histories histories;
-    std::atomic<bool> stopSearch{false};
+    SearchCounters counters;
     bool isMainThread = true;
+    int threadId = 0;
+    //other threads search alongside this one, so nodes in progress are shared through the searching table
+    bool sharedSearch = false;
     Move killerMoves[MAXPLY + 1];
     Move pvTable[MAXPLY + 1][MAXPLY + 1];
+
+    //last iteration searched to the end, read by the main thread to vote on the final move
+    int completedDepth = 0;
+    int completedScore = 0;
+    int completedPvLength = 0;
+    Move completedPv[MAXPLY + 1];
 };
 
 struct SearchLimitations
@@ -80,8 +111,11 @@ struct CopyMake
     uint64_t last_white_np;
     uint64_t last_black_np;
     uint64_t last_minor;
-    uint64_t last_irreversible;
+    uint16_t last_pliesFromNull;
     uint64_t last_halfmove;
+    uint64_t last_checkers;
+    uint64_t last_pinned;
+    uint64_t last_threats;
 };
 std::pair<Move, int> IterativeDeepening(
     Board& board,
@@ -91,9 +125,10 @@ std::pair<Move, int> IterativeDeepening(
     bool isBench = false
 );
 
+SearchStats CollectSearchStats();
+
 void Initialize_TT(int size);
 void InitializeLMRTable();
 void InitializeSearch(ThreadData& data);
 void InitNNUE();
-void refresh_if_cross(Move& move, Board& board);
 bool compareMoves(Move move1, Move16 move2);
\ No newline at end of file
@@ -0,0 +1,95 @@
+#include "Simd.h"
+#include <cstdint>
+
+#if is_x86
+    #if defined(_MSC_VER)
+        #include <intrin.h>
+    #else
+        #include <cpuid.h>
+    #endif
+#endif
+
+#if is_x86
+static void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t registers[4])
+{
+    #if defined(_MSC_VER)
+    int values[4];
+    __cpuidex(values, int(leaf), int(subleaf));
+    for (int i = 0; i < 4; i++)
+    {
+        registers[i] = uint32_t(values[i]);
+    }
+    #else
+    __cpuid_count(leaf, subleaf, registers[0], registers[1], registers[2], registers[3]);
+    #endif
+}
+//register state the OS saves on context switches, wide registers are unusable unless it includes them
+static uint64_t xgetbv()
+{
+    #if defined(_MSC_VER)
+    return _xgetbv(0);
+    #else
+    uint32_t eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return (uint64_t(edx) << 32) | eax;
+    #endif
+}
+#endif
+
+SimdLevel DetectSimdLevel()
+{
+#if is_x86
+    uint32_t registers[4];
+    cpuid(0, 0, registers);
+    uint32_t maxLeaf = registers[0];
+
+    cpuid(1, 0, registers);
+    bool sse2 = registers[3] & (1u << 26);
+    bool osxsave = registers[2] & (1u << 27);
+    bool avx = registers[2] & (1u << 28);
+    uint64_t xcr0 = osxsave ? xgetbv() : 0;
+    bool ymmState = (xcr0 & 0x06) == 0x06;
+    bool zmmState = (xcr0 & 0xe6) == 0xe6;
+
+    bool avx2 = false, avx512f = false, avx512bw = false, avx512vnni = false;
+    if (maxLeaf >= 7)
+    {
+        cpuid(7, 0, registers);
+        avx2 = registers[1] & (1u << 5);
+        avx512f = registers[1] & (1u << 16);
+        avx512bw = registers[1] & (1u << 30);
+        avx512vnni = registers[2] & (1u << 11);
+    }
+
+    if (avx512f && avx512bw && zmmState)
+    {
+        return avx512vnni ? SIMD_AVX512_VNNI : SIMD_AVX512;
+    }
+    if (avx && avx2 && ymmState)
+    {
+        return SIMD_AVX2;
+    }
+    if (sse2)
+    {
+        return SIMD_SSE2;
+    }
+#endif
+    return SIMD_SCALAR;
+}
+
+const char* SimdLevelName(SimdLevel level)
+{
+    switch (level)
+    {
+        case SIMD_SSE2:
+            return "sse2";
+        case SIMD_AVX2:
+            return "avx2";
+        case SIMD_AVX512:
+            return "avx512";
+        case SIMD_AVX512_VNNI:
+            return "avx512vnni";
+        default:
+            return "scalar";
+    }
+}
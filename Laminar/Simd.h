@@ -0,0 +1,22 @@
+#pragma once
+
+#if defined(__x86_64__) || defined(__amd64__) || (defined(_WIN64) && (defined(_M_X64) || defined(_M_AMD64)))
+    #define is_x86 1
+#else
+// TODO: arm
+    #define is_x86 0
+#endif
+
+//instruction sets the NNUE kernels are compiled for, from slowest to fastest
+enum SimdLevel
+{
+    SIMD_SCALAR = 0,
+    SIMD_SSE2,
+    SIMD_AVX2,
+    SIMD_AVX512,
+    SIMD_AVX512_VNNI,
+    SIMD_LEVEL_COUNT
+};
+
+SimdLevel DetectSimdLevel();
+const char* SimdLevelName(SimdLevel level);
@@ -0,0 +1,428 @@
+//NNUE kernels for one instruction set, Kernels.cpp includes this file once per KERNEL_ISA inside its own namespace
+//no include guard on purpose
+
+#if KERNEL_ISA == KERNEL_ISA_AVX512 || KERNEL_ISA == KERNEL_ISA_AVX512_VNNI
+using kernel_vector = __m512i;
+constexpr int TILE_REGISTERS = 16;
+inline kernel_vector load_epi16(const int16_t* ptr)
+{
+    return _mm512_load_si512(ptr);
+}
+inline void store_epi16(int16_t* ptr, kernel_vector vec)
+{
+    _mm512_store_si512(ptr, vec);
+}
+inline kernel_vector add_epi16(kernel_vector a, kernel_vector b)
+{
+    return _mm512_add_epi16(a, b);
+}
+inline kernel_vector sub_epi16(kernel_vector a, kernel_vector b)
+{
+    return _mm512_sub_epi16(a, b);
+}
+inline kernel_vector set1_epi16(int16_t value)
+{
+    return _mm512_set1_epi16(value);
+}
+inline kernel_vector min_epi16(kernel_vector a, kernel_vector b)
+{
+    return _mm512_min_epi16(a, b);
+}
+inline kernel_vector max_epi16(kernel_vector a, kernel_vector b)
+{
+    return _mm512_max_epi16(a, b);
+}
+inline kernel_vector mullo_epi16(kernel_vector a, kernel_vector b)
+{
+    return _mm512_mullo_epi16(a, b);
+}
+inline kernel_vector add_epi32(kernel_vector a, kernel_vector b)
+{
+    return _mm512_add_epi32(a, b);
+}
+//acc + madd(a, b), a single instruction with VNNI
+inline kernel_vector dpwssd_epi32(kernel_vector acc, kernel_vector a, kernel_vector b)
+{
+    #if KERNEL_ISA == KERNEL_ISA_AVX512_VNNI
+    return _mm512_dpwssd_epi32(acc, a, b);
+    #else
+    return _mm512_add_epi32(acc, _mm512_madd_epi16(a, b));
+    #endif
+}
+//folds to 256 bits first, the maskz extracts avoid the undefined passthrough GCC warns about in the plain ones
+inline int32_t reduce_epi32(kernel_vector vec)
+{
+    __m256i low = _mm512_maskz_extracti64x4_epi64(0xF, vec, 0);
+    __m256i ymm0 = _mm256_add_epi32(low, _mm512_maskz_extracti64x4_epi64(0xF, vec, 1));
+    __m128i xmm0 = _mm_add_epi32(_mm256_castsi256_si128(ymm0), _mm256_extracti128_si256(ymm0, 1));
+    __m128i xmm1 = _mm_shuffle_epi32(xmm0, 238);
+    xmm0 = _mm_add_epi32(xmm0, xmm1);
+    xmm1 = _mm_shuffle_epi32(xmm0, 85);
+    xmm0 = _mm_add_epi32(xmm0, xmm1);
+    return _mm_cvtsi128_si32(xmm0);
+}
+#elif KERNEL_ISA == KERNEL_ISA_AVX2
+using kernel_vector = __m256i;
+constexpr int TILE_REGISTERS = 16;
+inline kernel_vector load_epi16(const int16_t* ptr)
+{
+    return _mm256_load_si256(reinterpret_cast<kernel_vector const*>(ptr));
+}
+inline void store_epi16(int16_t* ptr, kernel_vector vec)
+{
+    _mm256_store_si256(reinterpret_cast<kernel_vector*>(ptr), vec);
+}
+inline kernel_vector add_epi16(kernel_vector a, kernel_vector b)
+{
+    return _mm256_add_epi16(a, b);
+}
+inline kernel_vector sub_epi16(kernel_vector a, kernel_vector b)
+{
+    return _mm256_sub_epi16(a, b);
+}
+inline kernel_vector set1_epi16(int16_t value)
+{
+    return _mm256_set1_epi16(value);
+}
+inline kernel_vector min_epi16(kernel_vector a, kernel_vector b)
+{
+    return _mm256_min_epi16(a, b);
+}
+inline kernel_vector max_epi16(kernel_vector a, kernel_vector b)
+{
+    return _mm256_max_epi16(a, b);
+}
+inline kernel_vector mullo_epi16(kernel_vector a, kernel_vector b)
+{
+    return _mm256_mullo_epi16(a, b);
+}
+inline kernel_vector add_epi32(kernel_vector a, kernel_vector b)
+{
+    return _mm256_add_epi32(a, b);
+}
+inline kernel_vector dpwssd_epi32(kernel_vector acc, kernel_vector a, kernel_vector b)
+{
+    return _mm256_add_epi32(acc, _mm256_madd_epi16(a, b));
+}
+// based on output from zig 0.14.0 for @reduce(.Add, @as(@Vector(8, i32), x)
+inline int32_t reduce_epi32(kernel_vector vec)
+{
+    __m128i xmm1 = _mm256_extracti128_si256(vec, 1);
+    __m128i xmm0 = _mm256_castsi256_si128(vec);
+    xmm0 = _mm_add_epi32(xmm0, xmm1);
+    xmm1 = _mm_shuffle_epi32(xmm0, 238);
+    xmm0 = _mm_add_epi32(xmm0, xmm1);
+    xmm1 = _mm_shuffle_epi32(xmm0, 85);
+    xmm0 = _mm_add_epi32(xmm0, xmm1);
+    return _mm_cvtsi128_si32(xmm0);
+}
+#elif KERNEL_ISA == KERNEL_ISA_SSE2
+using kernel_vector = __m128i;
+constexpr int TILE_REGISTERS = 8;
+inline kernel_vector load_epi16(const int16_t* ptr)
+{
+    return _mm_load_si128(reinterpret_cast<kernel_vector const*>(ptr));
+}
+inline void store_epi16(int16_t* ptr, kernel_vector vec)
+{
+    _mm_store_si128(reinterpret_cast<kernel_vector*>(ptr), vec);
+}
+inline kernel_vector add_epi16(kernel_vector a, kernel_vector b)
+{
+    return _mm_add_epi16(a, b);
+}
+inline kernel_vector sub_epi16(kernel_vector a, kernel_vector b)
+{
+    return _mm_sub_epi16(a, b);
+}
+inline kernel_vector set1_epi16(int16_t value)
+{
+    return _mm_set1_epi16(value);
+}
+inline kernel_vector min_epi16(kernel_vector a, kernel_vector b)
+{
+    return _mm_min_epi16(a, b);
+}
+inline kernel_vector max_epi16(kernel_vector a, kernel_vector b)
+{
+    return _mm_max_epi16(a, b);
+}
+inline kernel_vector mullo_epi16(kernel_vector a, kernel_vector b)
+{
+    return _mm_mullo_epi16(a, b);
+}
+inline kernel_vector add_epi32(kernel_vector a, kernel_vector b)
+{
+    return _mm_add_epi32(a, b);
+}
+inline kernel_vector dpwssd_epi32(kernel_vector acc, kernel_vector a, kernel_vector b)
+{
+    return _mm_add_epi32(acc, _mm_madd_epi16(a, b));
+}
+// based on output from zig 0.14.0 for @reduce(.Add, @as(@Vector(4, i32), x)
+inline int32_t reduce_epi32(kernel_vector vec)
+{
+    __m128i xmm1 = _mm_shuffle_epi32(vec, 238);
+    vec = _mm_add_epi32(vec, xmm1);
+    xmm1 = _mm_shuffle_epi32(vec, 85);
+    vec = _mm_add_epi32(vec, xmm1);
+    return _mm_cvtsi128_si32(vec);
+}
+#endif
+
+#if KERNEL_ISA != KERNEL_ISA_SCALAR
+//largest register count that splits the hidden layer into whole tiles
+constexpr int tileRegisterCount(int vectors)
+{
+    int count = TILE_REGISTERS;
+    while (vectors % count != 0)
+    {
+        count--;
+    }
+    return count;
+}
+#endif
+
+//output = input + sum(adds) - sum(subs)
+//the accumulator is processed in tiles that stay in registers while every feature row is added,
+//so each tile is loaded and stored once no matter how many features there are
+template <typename Arch>
+static void accumulatorTiledUpdate(
+    const Network<Arch>* const network,
+    const int16_t* input,
+    struct Accumulator* output,
+    const size_t* adds,
+    int addCount,
+    const size_t* subs,
+    int subCount
+)
+{
+#if KERNEL_ISA != KERNEL_ISA_SCALAR
+    constexpr int VECTOR_SIZE = sizeof(kernel_vector) / sizeof(std::int16_t);
+    static_assert(Arch::HL_SIZE % VECTOR_SIZE == 0, "HL_SIZE must be divisible by the native register size");
+    constexpr int REGISTERS = tileRegisterCount(Arch::HL_SIZE / VECTOR_SIZE);
+    constexpr int TILE_SIZE = REGISTERS * VECTOR_SIZE;
+
+    kernel_vector tile[REGISTERS];
+    for (int offset = 0; offset < Arch::HL_SIZE; offset += TILE_SIZE)
+    {
+        for (int r = 0; r < REGISTERS; r++)
+        {
+            tile[r] = load_epi16(&input[offset + r * VECTOR_SIZE]);
+        }
+        for (int j = 0; j < addCount; j++)
+        {
+            const int16_t* weights = &network->accumulator_weights[adds[j]][offset];
+            for (int r = 0; r < REGISTERS; r++)
+            {
+                tile[r] = add_epi16(tile[r], load_epi16(&weights[r * VECTOR_SIZE]));
+            }
+        }
+        for (int j = 0; j < subCount; j++)
+        {
+            const int16_t* weights = &network->accumulator_weights[subs[j]][offset];
+            for (int r = 0; r < REGISTERS; r++)
+            {
+                tile[r] = sub_epi16(tile[r], load_epi16(&weights[r * VECTOR_SIZE]));
+            }
+        }
+        for (int r = 0; r < REGISTERS; r++)
+        {
+            store_epi16(&output->values[offset + r * VECTOR_SIZE], tile[r]);
+        }
+    }
+#else
+    if (input != output->values)
+    {
+        memcpy(output->values, input, Arch::HL_SIZE * sizeof(int16_t));
+    }
+    for (int j = 0; j < addCount; j++)
+    {
+        for (int i = 0; i < Arch::HL_SIZE; i++)
+            output->values[i] += network->accumulator_weights[adds[j]][i];
+    }
+    for (int j = 0; j < subCount; j++)
+    {
+        for (int i = 0; i < Arch::HL_SIZE; i++)
+            output->values[i] -= network->accumulator_weights[subs[j]][i];
+    }
+#endif
+}
+
+//applies every feature change of a move in a single pass over the accumulator
+template <typename Arch, int AddCount, int SubCount>
+inline void accumulatorFusedUpdate(
+    const Network<Arch>* const network,
+    const struct Accumulator* input,
+    struct Accumulator* output,
+    const size_t* adds,
+    const size_t* subs
+)
+{
+#if KERNEL_ISA != KERNEL_ISA_SCALAR
+    constexpr int VECTOR_SIZE = sizeof(kernel_vector) / sizeof(std::int16_t);
+    static_assert(Arch::HL_SIZE % VECTOR_SIZE == 0, "HL_SIZE must be divisible by the native register size");
+
+    for (int i = 0; i < Arch::HL_SIZE; i += VECTOR_SIZE)
+    {
+        kernel_vector values = load_epi16(&input->values[i]);
+        for (int j = 0; j < AddCount; j++)
+        {
+            values = add_epi16(values, load_epi16(&network->accumulator_weights[adds[j]][i]));
+        }
+        for (int j = 0; j < SubCount; j++)
+        {
+            values = sub_epi16(values, load_epi16(&network->accumulator_weights[subs[j]][i]));
+        }
+        store_epi16(&output->values[i], values);
+    }
+#else
+    accumulatorTiledUpdate<Arch>(network, input->values, output, adds, AddCount, subs, SubCount);
+#endif
+}
+
+//sum of screlu(accumulator) * output weights over both perspectives
+template <typename Arch>
+static int32_t screlu(const Network<Arch>* const network, const Accumulator* stm, const Accumulator* nstm)
+{
+#if KERNEL_ISA != KERNEL_ISA_SCALAR
+    constexpr int VECTOR_SIZE = sizeof(kernel_vector) / sizeof(std::int16_t);
+    static_assert(
+        Arch::HL_SIZE % VECTOR_SIZE == 0,
+        "HL_SIZE must be divisible by the native register size for this vectorization implementation to work"
+    );
+    constexpr int UNROLL = Arch::HL_SIZE % (2 * VECTOR_SIZE) == 0 ? 2 : 1;
+    const kernel_vector VEC_QA = set1_epi16(Arch::QA);
+    const kernel_vector VEC_ZERO = set1_epi16(0);
+
+    kernel_vector accumulator[UNROLL];
+    for (int j = 0; j < UNROLL; j++)
+    {
+        accumulator[j] = VEC_ZERO;
+    }
+    for (int i = 0; i < Arch::HL_SIZE; i += UNROLL * VECTOR_SIZE)
+    {
+        for (int j = 0; j < UNROLL; j++)
+        {
+            const int idx = i + j * VECTOR_SIZE;
+            // load accumulator values
+            const kernel_vector stm_accum_values = load_epi16(&stm->values[idx]);
+            const kernel_vector nstm_accum_values = load_epi16(&nstm->values[idx]);
+
+            // load network weights
+            const kernel_vector stm_weights = load_epi16(&network->output_weights[idx]);
+            const kernel_vector nstm_weights = load_epi16(&network->output_weights[idx + Arch::HL_SIZE]);
+
+            // clamp the values to [0, QA]
+            const kernel_vector stm_clamped = min_epi16(VEC_QA, max_epi16(stm_accum_values, VEC_ZERO));
+            const kernel_vector nstm_clamped = min_epi16(VEC_QA, max_epi16(nstm_accum_values, VEC_ZERO));
+
+            // apply lizard screlu
+            accumulator[j] = dpwssd_epi32(accumulator[j], stm_clamped, mullo_epi16(stm_clamped, stm_weights));
+            accumulator[j] = dpwssd_epi32(accumulator[j], nstm_clamped, mullo_epi16(nstm_clamped, nstm_weights));
+        }
+    }
+    for (int j = 1; j < UNROLL; j++)
+    {
+        accumulator[0] = add_epi32(accumulator[0], accumulator[j]);
+    }
+    return reduce_epi32(accumulator[0]);
+#else
+    std::int32_t accumulator{};
+    for (int i = 0; i < Arch::HL_SIZE; i++)
+    {
+        const int32_t stm_clamped = std::clamp<int32_t>(stm->values[i], 0, Arch::QA);
+        const int32_t nstm_clamped = std::clamp<int32_t>(nstm->values[i], 0, Arch::QA);
+        accumulator += stm_clamped * stm_clamped * network->output_weights[i];
+        accumulator += nstm_clamped * nstm_clamped * network->output_weights[i + Arch::HL_SIZE];
+    }
+    return accumulator;
+#endif
+}
+
+template <typename Arch>
+static void archUpdate(
+    const void* network,
+    const int16_t* input,
+    struct Accumulator* output,
+    const size_t* adds,
+    int addCount,
+    const size_t* subs,
+    int subCount
+)
+{
+    const Network<Arch>* typed = static_cast<const Network<Arch>*>(network);
+    accumulatorTiledUpdate<Arch>(typed, input, output, adds, addCount, subs, subCount);
+}
+
+//quiet moves and promotions
+template <typename Arch>
+static void archAddSub(
+    const void* network,
+    const struct Accumulator* input,
+    struct Accumulator* output,
+    size_t add,
+    size_t sub
+)
+{
+    accumulatorFusedUpdate<Arch, 1, 1>(static_cast<const Network<Arch>*>(network), input, output, &add, &sub);
+}
+
+//captures
+template <typename Arch>
+static void archAddSubSub(
+    const void* network,
+    const struct Accumulator* input,
+    struct Accumulator* output,
+    size_t add,
+    size_t sub1,
+    size_t sub2
+)
+{
+    size_t subs[2] = {sub1, sub2};
+    accumulatorFusedUpdate<Arch, 1, 2>(static_cast<const Network<Arch>*>(network), input, output, &add, subs);
+}
+
+//castling
+template <typename Arch>
+static void archAddAddSubSub(
+    const void* network,
+    const struct Accumulator* input,
+    struct Accumulator* output,
+    size_t add1,
+    size_t add2,
+    size_t sub1,
+    size_t sub2
+)
+{
+    size_t adds[2] = {add1, add2};
+    size_t subs[2] = {sub1, sub2};
+    accumulatorFusedUpdate<Arch, 2, 2>(static_cast<const Network<Arch>*>(network), input, output, adds, subs);
+}
+
+template <typename Arch>
+static int32_t archForward(const void* weights, const Accumulator* stm, const Accumulator* nstm)
+{
+    const Network<Arch>* network = static_cast<const Network<Arch>*>(weights);
+    int32_t eval = screlu<Arch>(network, stm, nstm);
+
+    eval /= Arch::QA;
+    eval += network->output_bias;
+
+    eval *= Arch::SCALE;
+    eval /= Arch::QA * Arch::QB;
+
+    return eval;
+}
+
+template <typename Arch>
+NetworkKernels kernels()
+{
+    NetworkKernels kernels;
+    kernels.update = archUpdate<Arch>;
+    kernels.addSub = archAddSub<Arch>;
+    kernels.addSubSub = archAddSubSub<Arch>;
+    kernels.addAddSubSub = archAddAddSubSub<Arch>;
+    kernels.forward = archForward<Arch>;
+    return kernels;
+}
@@ -1,28 +1,145 @@
 #include "Threading.h"
 #include "Board.h"
+#include "NNUE.h"
+#include "Numa.h"
 #include "Search.h"
 #include <iostream>
 #include <thread>
 
 std::vector<std::unique_ptr<Worker>> threadPool = {};
+bool NumaAware = true;
+
+//sleeps until the hard time limit of the running search and raises stopSearch,
+//so the search itself never has to read the clock
+struct StopTimer
+{
+    std::thread thread;
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+    bool exit = false;
+
+    //while pondering the clock has not started, the hard limit waits here until ponderhit
+    bool pondering = false;
+    int64_t pendingLimitMS = NOLIMIT;
+    std::chrono::steady_clock::time_point ponderHitTime;
+    std::condition_variable ponderCv;
+};
+static StopTimer stopTimer;
+
+static void stopTimerLoop()
+{
+    std::unique_lock<std::mutex> lock(stopTimer.mtx);
+    while (!stopTimer.exit)
+    {
+        if (stopTimer.deadline == std::chrono::steady_clock::time_point::max())
+        {
+            stopTimer.cv.wait(lock);
+        }
+        else if (std::chrono::steady_clock::now() >= stopTimer.deadline)
+        {
+            stopSearch.store(true, std::memory_order_relaxed);
+            stopTimer.deadline = std::chrono::steady_clock::time_point::max();
+        }
+        else
+        {
+            stopTimer.cv.wait_until(lock, stopTimer.deadline);
+        }
+    }
+}
+void armStopTimer(std::chrono::steady_clock::time_point clockStart, int64_t limitMS)
+{
+    std::lock_guard<std::mutex> lock(stopTimer.mtx);
+    if (stopTimer.pondering)
+    {
+        stopTimer.pendingLimitMS = limitMS;
+        return;
+    }
+    //a ponderhit may have arrived after the caller last looked at the clock
+    clockStart = std::max(clockStart, stopTimer.ponderHitTime);
+    stopTimer.deadline = clockStart + std::chrono::milliseconds(limitMS);
+    stopTimer.cv.notify_one();
+}
+//a timer that already fired has raised the flag before this returns
+void disarmStopTimer()
+{
+    std::lock_guard<std::mutex> lock(stopTimer.mtx);
+    stopTimer.deadline = std::chrono::steady_clock::time_point::max();
+    stopTimer.pendingLimitMS = NOLIMIT;
+    stopTimer.cv.notify_one();
+}
+//the predicted move was played, the running search carries on against the real clock from now
+void ponderHit()
+{
+    std::lock_guard<std::mutex> lock(stopTimer.mtx);
+    if (!stopTimer.pondering)
+    {
+        return;
+    }
+    stopTimer.pondering = false;
+    stopTimer.ponderHitTime = std::chrono::steady_clock::now();
+    if (stopTimer.pendingLimitMS != NOLIMIT)
+    {
+        stopTimer.deadline = stopTimer.ponderHitTime + std::chrono::milliseconds(stopTimer.pendingLimitMS);
+        stopTimer.pendingLimitMS = NOLIMIT;
+        stopTimer.cv.notify_one();
+    }
+    stopTimer.ponderCv.notify_all();
+}
+//true while the search is pondering, after a ponderhit moves clockStart to the moment it arrived
+bool stillPondering(std::chrono::steady_clock::time_point& clockStart, bool wasPondering)
+{
+    std::lock_guard<std::mutex> lock(stopTimer.mtx);
+    if (wasPondering && !stopTimer.pondering)
+    {
+        clockStart = stopTimer.ponderHitTime;
+    }
+    return stopTimer.pondering;
+}
+//a pondering search may not report bestmove before ponderhit or stop, even if it has nothing left to search
+void waitForPonderEnd()
+{
+    std::unique_lock<std::mutex> lock(stopTimer.mtx);
+    stopTimer.ponderCv.wait(lock, [] { return !stopTimer.pondering || stopSearch.load(); });
+}
 
 void workerLoop(Worker* worker)
 {
+    if (worker->node >= 0)
+    {
+        PinThreadToNode(worker->node);
+    }
+    UseNetworkReplica(worker->node);
+    auto data = std::make_unique<ThreadData>();
+    InitializeSearch(*data);
+
     std::unique_lock<std::mutex> lock(worker->mtx);
+    worker->data = std::move(data);
+    worker->ready = true;
+    worker->cv.notify_all();
 
     while (true)
     {
-        worker->cv.wait(lock, [&] { return worker->searching.load() || worker->exit.load(); });
+        worker->cv.wait(lock, [&] { return worker->searching.load() || worker->exit.load() || worker->working; });
 
         //stop if exit is true
         if (worker->exit.load())
         {
-            worker->data.stopSearch.store(true, std::memory_order_release);
             return;
         }
+        if (worker->working)
+        {
+            std::function<void()> job = std::move(worker->job);
+            lock.unlock();
+            job();
+            lock.lock();
+            worker->working = false;
+            worker->cv.notify_all();
+            continue;
+        }
 
-        worker->data.stopSearch.store(false, std::memory_order_release);
-        worker->data.isMainThread = (worker->id == 0);
+        worker->data->isMainThread = (worker->id == 0);
+        worker->data->threadId = worker->id;
 
         Board localBoard = worker->board;
         SearchLimitations limits = worker->limits;
@@ -31,36 +148,44 @@ void workerLoop(Worker* worker)
         //searching == true
         lock.unlock();
 
-        IterativeDeepening(localBoard, depth, limits, worker->data, false);
+        IterativeDeepening(localBoard, depth, limits, *worker->data, false);
 
         lock.lock();
         worker->searching.store(false, std::memory_order_release);
-        worker->cv.notify_one();
+        //both the UCI thread and the main search thread may be waiting for this
+        worker->cv.notify_all();
     }
 }
 void startWorkers(int threadCount)
 {
     threadPool.clear();
     threadPool.reserve(threadCount);
+    stopTimer.exit = false;
+    stopTimer.thread = std::thread(stopTimerLoop);
     for (int i = 0; i < threadCount; i++)
     {
         auto worker = std::make_unique<Worker>();
         worker->id = i;
-        InitializeSearch(worker->data);
-        worker->data.stopSearch.store(false);
+        //pinning only pays off when there is more than one node to keep apart
+        worker->node = NumaAware && NumaNodeCount() > 1 ? NumaNodeForThread(i) : -1;
         worker->searching.store(false);
         worker->exit.store(false);
 
         worker->thread = std::thread(workerLoop, worker.get());
         threadPool.push_back(std::move(worker));
     }
+    for (auto& worker : threadPool)
+    {
+        std::unique_lock<std::mutex> lock(worker->mtx);
+        worker->cv.wait(lock, [&] { return worker->ready; });
+    }
 }
 void destroyWorkers()
 {
+    stopSearch.store(true, std::memory_order_release);
     for (auto& worker : threadPool)
     {
         worker->exit.store(true, std::memory_order_release);
-        worker->data.stopSearch.store(true, std::memory_order_release);
     }
     for (auto& worker : threadPool)
     {
@@ -72,14 +197,34 @@ void destroyWorkers()
             worker->thread.join();
     }
     threadPool.clear();
+
+    {
+        std::lock_guard<std::mutex> lock(stopTimer.mtx);
+        stopTimer.exit = true;
+        stopTimer.cv.notify_one();
+    }
+    if (stopTimer.thread.joinable())
+    {
+        stopTimer.thread.join();
+    }
 }
-void startSearch(const Board& board, SearchLimitations limits, int depth)
+void startSearch(const Board& board, const KeyStack& keys, SearchLimitations limits, int depth, bool ponder)
 {
+    //entries from earlier searches become preferred victims
+    ttNewSearch();
+    stopSearch.store(false, std::memory_order_release);
+    {
+        std::lock_guard<std::mutex> lock(stopTimer.mtx);
+        stopTimer.pondering = ponder;
+        stopTimer.pendingLimitMS = NOLIMIT;
+    }
     for (auto& worker : threadPool)
     {
         std::lock_guard<std::mutex> lock(worker->mtx);
 
         worker->board = board;
+        //straight into the worker's own stack, only the keys of the game so far are copied
+        worker->data->keys.assign(keys);
         worker->limits = limits;
         worker->depth = depth;
 
@@ -90,10 +235,44 @@ void startSearch(const Board& board, SearchLimitations limits, int depth)
         worker->cv.notify_all();
     }
 }
-void stopCurrentSearch()
+//runs job(id, count) on every idle worker at once and waits for all of them,
+//falls back to the calling thread before the pool exists
+void runOnWorkers(const std::function<void(int id, int count)>& job)
 {
+    int count = static_cast<int>(threadPool.size());
+    if (count == 0)
+    {
+        job(0, 1);
+        return;
+    }
+    for (auto& worker : threadPool)
+    {
+        std::lock_guard<std::mutex> lock(worker->mtx);
+        int id = worker->id;
+        worker->job = [&job, id, count]() { job(id, count); };
+        worker->working = true;
+    }
+    for (auto& worker : threadPool)
+    {
+        worker->cv.notify_all();
+    }
     for (auto& worker : threadPool)
-        worker->data.stopSearch.store(true, std::memory_order_release);
+    {
+        std::unique_lock<std::mutex> lock(worker->mtx);
+        worker->cv.wait(lock, [&] { return !worker->working; });
+    }
+}
+void stopCurrentSearch()
+{
+    stopSearch.store(true, std::memory_order_release);
+    {
+        std::lock_guard<std::mutex> lock(stopTimer.mtx);
+        stopTimer.ponderCv.notify_all();
+    }
+    waitForSearch();
+}
+void waitForSearch()
+{
     for (auto& w : threadPool)
     {
         std::unique_lock<std::mutex> lk(w->mtx);
@@ -101,6 +280,20 @@ void stopCurrentSearch()
     }
 }
 
+//called by the main search thread after raising the stop flag, so it can read the helpers' results
+void waitForHelpers()
+{
+    for (auto& worker : threadPool)
+    {
+        if (worker->id == 0)
+        {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(worker->mtx);
+        worker->cv.wait(lock, [&] { return !worker->searching.load(std::memory_order_acquire); });
+    }
+}
+
 //Lazy SMP
 //simply run multiple searches in helper threads, and share TT
 //to allow more cutoffs in the main thread
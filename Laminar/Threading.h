@@ -2,23 +2,34 @@
 #include "Board.h"
 #include "Search.h"
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <functional>
+#include <memory>
 #include <mutex>
 #include <thread>
 
 struct alignas(64) Worker
 {
-    ThreadData data;
+    //allocated by the worker itself once it is pinned, so the pages are first touched on its own NUMA node
+    std::unique_ptr<ThreadData> data;
     std::thread thread;
 
     std::condition_variable cv;
     std::mutex mtx;
 
     int id = 0;
+    //NUMA node the worker is pinned to, -1 when it is left to the OS
+    int node = -1;
+    bool ready = false;
 
     std::atomic<bool> searching{false};
     std::atomic<bool> exit{false};
 
+    //work handed to an idle worker outside of search, e.g. clearing its slice of the TT
+    std::function<void()> job;
+    bool working = false;
+
     // search inputs
     Board board;
     SearchLimitations limits;
@@ -26,9 +37,17 @@ struct alignas(64) Worker
 };
 
 extern std::vector<std::unique_ptr<Worker>> threadPool;
+extern bool NumaAware;
 void workerLoop(Worker* worker);
 void startWorkers(int threadCount);
 void destroyWorkers();
-void destroyWorkers();
-void startSearch(const Board& board, SearchLimitations limits, int depth);
+void startSearch(const Board& board, const KeyStack& keys, SearchLimitations limits, int depth, bool ponder = false);
 void stopCurrentSearch();
+void waitForSearch();
+void waitForHelpers();
+void runOnWorkers(const std::function<void(int id, int count)>& job);
+void armStopTimer(std::chrono::steady_clock::time_point clockStart, int64_t limitMS);
+void disarmStopTimer();
+void ponderHit();
+bool stillPondering(std::chrono::steady_clock::time_point& clockStart, bool wasPondering);
+void waitForPonderEnd();
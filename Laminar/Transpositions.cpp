@@ -1,52 +1,466 @@
 #include "Transpositions.h"
 #include "Const.h"
+#include "MappedFile.h"
+#include "NNUE.h"
+#include "Threading.h"
+#include <climits>
+#include <cstring>
 #include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <new>
 #include <stddef.h>
+#include <vector>
+#include <utility>
+#if !defined(__SIZEOF_INT128__) && defined(_MSC_VER)
+    #include <intrin.h>
+#endif
 
-size_t TTSize = 1; //initial value
-TranspositionEntry* TranspositionTable = nullptr;
-void Initialize_TT(int size)
+size_t TTSize = 1; //initial value, in buckets
+TranspositionBucket* TranspositionTable = nullptr;
+uint8_t TTGeneration = 0;
+
+constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+static size_t TableBytes = 0;
+static bool TableHugeTlb = false;
+static const char* TablePages = "normal";
+
+//maps the key onto [0, size) with a multiply-shift instead of a division
+static inline size_t bucketIndex(uint64_t zobrist, size_t size)
 {
-    //std::cout <<"size" << size << "\n";
-    uint64_t bytes = static_cast<uint64_t>(size) * 1024ULL * 1024ULL;
+#if defined(__SIZEOF_INT128__)
+    return static_cast<size_t>((static_cast<unsigned __int128>(zobrist) * size) >> 64);
+#else
+    return static_cast<size_t>(__umulh(zobrist, size));
+#endif
+}
+static inline size_t ttIndex(uint64_t zobrist)
+{
+    return bucketIndex(zobrist, TTSize);
+}
 
-    //std::cout << bytes<<"\n";
-    TTSize = bytes / sizeof(TranspositionEntry);
+//bytes is a multiple of the huge page size
+static void* allocateTable(size_t bytes, bool& hugeTlb)
+{
+    hugeTlb = false;
+#if defined(_WIN32)
+    //large pages need the lock memory privilege, without it the first call simply fails
+    void* memory = VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+    TablePages = memory ? "huge" : "normal";
+    if (!memory)
+    {
+        memory = VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    }
+    return memory;
+#else
+    #if defined(MAP_HUGETLB)
+    //explicit huge pages only succeed when the system has reserved some
+    void* mapped = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    hugeTlb = mapped != MAP_FAILED;
+    if (hugeTlb)
+    {
+        TablePages = "huge";
+        return mapped;
+    }
+    #endif
+    void* memory = std::aligned_alloc(HUGE_PAGE_SIZE, bytes);
+    TablePages = "normal";
+    #if defined(MADV_HUGEPAGE)
+    //otherwise ask for transparent huge pages, the alignment lets every 2 MB of the table use one
+    if (memory && madvise(memory, bytes, MADV_HUGEPAGE) == 0)
+    {
+        TablePages = "transparent huge";
+    }
+    #endif
+    return memory;
+#endif
+}
+static void freeTable(void* memory, size_t bytes, bool hugeTlb)
+{
+    if (!memory)
+    {
+        return;
+    }
+#if defined(_WIN32)
+    VirtualFree(memory, 0, MEM_RELEASE);
+#else
+    if (hugeTlb)
+    {
+        munmap(memory, bytes);
+    }
+    else
+    {
+        std::free(memory);
+    }
+#endif
+}
+//every worker constructs its own slice of the buckets
+static void constructBuckets(TranspositionBucket* table, size_t size)
+{
+    runOnWorkers(
+        [=](int id, int count)
+        {
+            size_t begin = size * id / count;
+            size_t end = size * (id + 1) / count;
+            for (size_t i = begin; i < end; i++)
+            {
+                new (&table[i]) TranspositionBucket();
+            }
+        }
+    );
+}
+static void migrateTable(TranspositionBucket* from, size_t fromSize, TranspositionBucket* to, size_t toSize);
 
-    if (TTSize % 2 != 0)
+void Initialize_TT(int size)
+{
+    uint64_t bytes = static_cast<uint64_t>(size) * 1024ULL * 1024ULL;
+    size_t newSize = bytes / sizeof(TranspositionBucket);
+    size_t newBytes = (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    bool newHugeTlb = false;
+    TranspositionBucket* table = static_cast<TranspositionBucket*>(allocateTable(newBytes, newHugeTlb));
+    if (!table)
     {
-        TTSize -= 1;
+        throw std::bad_alloc();
     }
 
-    if (TranspositionTable)
-        delete[] TranspositionTable;
+    //the clear is also the first touch, so the page faults are spread over the workers
+    constructBuckets(table, newSize);
 
-    TranspositionTable = new TranspositionEntry[TTSize]();
+    //a resize keeps what the old table has learned, both tables are alive until the entries moved
+    if (TranspositionTable)
+    {
+        migrateTable(TranspositionTable, TTSize, table, newSize);
+        freeTable(TranspositionTable, TableBytes, TableHugeTlb);
+    }
+    TranspositionTable = table;
+    TTSize = newSize;
+    TableBytes = newBytes;
+    TableHugeTlb = newHugeTlb;
+}
+const char* ttPageKind()
+{
+    return TablePages;
 }
 void ClearTT()
 {
-    if (TranspositionTable && TTSize > 0)
+    if (!TranspositionTable)
     {
-        std::fill(TranspositionTable, TranspositionTable + TTSize, TranspositionEntry());
+        return;
     }
+    constructBuckets(TranspositionTable, TTSize);
+    TTGeneration = 0;
+}
+void SwapTT(TranspositionBucket*& table, size_t& size)
+{
+    std::swap(TranspositionTable, table);
+    std::swap(TTSize, size);
+}
+void ttNewSearch()
+{
+    TTGeneration = (TTGeneration + 1) % TT_GENERATION_CYCLE;
 }
+
+//data word: bits 0-15 move, 16-31 static eval, 32-46 packed info, 47-63 score
+//a zero word is an empty slot
+static_assert(MAXSCORE < (1 << 16), "scores must fit in 17 signed bits");
+static inline uint64_t packEntry(const TranspositionEntry& entry)
+{
+    return uint64_t(entry.bestMove.data) | (uint64_t(uint16_t(entry.staticEval)) << 16)
+         | (uint64_t(entry.packedInfo & 0x7FFF) << 32) | (uint64_t(entry.score) << 47);
+}
+static inline TranspositionEntry unpackEntry(uint64_t zobrist, uint64_t data)
+{
+    TranspositionEntry entry;
+    entry.key = zobrist;
+    entry.bestMove.data = uint16_t(data);
+    entry.staticEval = int16_t(uint16_t(data >> 16));
+    entry.packedInfo = uint16_t((data >> 32) & 0x7FFF);
+    entry.score = int32_t(int64_t(data) >> 47);
+    return entry;
+}
+static inline void writeSlot(TranspositionSlot& slot, uint64_t zobrist, uint64_t data)
+{
+    slot.keyXorData.store(zobrist ^ data, std::memory_order_relaxed);
+    slot.data.store(data, std::memory_order_relaxed);
+}
+
 TranspositionEntry ttLookUp(uint64_t zobrist)
 {
-    int tt_index = zobrist % TTSize;
-    return TranspositionTable[tt_index];
+    TranspositionBucket& bucket = TranspositionTable[ttIndex(zobrist)];
+    for (TranspositionSlot& slot : bucket.slots)
+    {
+        uint64_t data = slot.data.load(std::memory_order_relaxed);
+        if (data == 0 || (slot.keyXorData.load(std::memory_order_relaxed) ^ data) != zobrist)
+        {
+            continue;
+        }
+        TranspositionEntry entry = unpackEntry(zobrist, data);
+        //a probed entry is still useful, so it should not age out
+        if (unpackGeneration(entry.packedInfo) != TTGeneration)
+        {
+            entry.packedInfo = withGeneration(entry.packedInfo, TTGeneration);
+            writeSlot(slot, zobrist, packEntry(entry));
+        }
+        return entry;
+    }
+    return TranspositionEntry();
+}
+//how many searches ago the entry was stored
+static inline int entryAge(uint16_t packedInfo)
+{
+    return (TTGeneration - unpackGeneration(packedInfo)) & (TT_GENERATION_CYCLE - 1);
 }
-void ttStore(TranspositionEntry& ttEntry, Board& board)
+//lowest value is replaced first: empty slots, then shallow entries from old searches
+static inline int replacementValue(uint64_t data)
 {
-    TranspositionTable[board.zobristKey % TTSize] = ttEntry;
+    if (data == 0)
+    {
+        return INT_MIN;
+    }
+    uint16_t packedInfo = uint16_t((data >> 32) & 0x7FFF);
+    return unpackDepth(packedInfo) - 8 * entryAge(packedInfo);
+}
+void ttStore(TranspositionEntry& ttEntry, uint64_t zobrist)
+{
+    TranspositionBucket& bucket = TranspositionTable[ttIndex(zobrist)];
+    TranspositionSlot* victim = &bucket.slots[0];
+    uint64_t victimData = victim->data.load(std::memory_order_relaxed);
+    bool samePosition = false;
+    for (TranspositionSlot& slot : bucket.slots)
+    {
+        uint64_t data = slot.data.load(std::memory_order_relaxed);
+        if (data != 0 && (slot.keyXorData.load(std::memory_order_relaxed) ^ data) == zobrist)
+        {
+            victim = &slot;
+            victimData = data;
+            samePosition = true;
+            break;
+        }
+        if (replacementValue(data) < replacementValue(victimData))
+        {
+            victim = &slot;
+            victimData = data;
+        }
+    }
+    if (samePosition)
+    {
+        TranspositionEntry old = unpackEntry(zobrist, victimData);
+        //keep the old move rather than forgetting it
+        if (ttEntry.bestMove.data == 0)
+        {
+            ttEntry.bestMove = old.bestMove;
+        }
+        //a much shallower bound from the same search is worth less than what is already there
+        if (unpackBound(ttEntry.packedInfo) != HFEXACT && entryAge(old.packedInfo) == 0
+            && unpackDepth(ttEntry.packedInfo) + 4 <= unpackDepth(old.packedInfo))
+        {
+            return;
+        }
+    }
+    ttEntry.packedInfo = withGeneration(ttEntry.packedInfo, TTGeneration);
+    writeSlot(*victim, zobrist, packEntry(ttEntry));
+}
+//places one live entry in its new bucket, a full bucket keeps its most valuable entries
+static void migrateEntry(TranspositionBucket& bucket, uint64_t zobrist, uint64_t data)
+{
+    TranspositionSlot* victim = &bucket.slots[0];
+    uint64_t victimData = victim->data.load(std::memory_order_relaxed);
+    for (TranspositionSlot& slot : bucket.slots)
+    {
+        uint64_t current = slot.data.load(std::memory_order_relaxed);
+        if (replacementValue(current) < replacementValue(victimData))
+        {
+            victim = &slot;
+            victimData = current;
+        }
+    }
+    if (replacementValue(data) > replacementValue(victimData))
+    {
+        writeSlot(*victim, zobrist, data);
+    }
+}
+//the bucket index grows with the key in both tables, so consecutive old slices land in
+//consecutive new ranges and the workers only ever share the bucket on a slice boundary
+static void migrateTable(TranspositionBucket* from, size_t fromSize, TranspositionBucket* to, size_t toSize)
+{
+    runOnWorkers(
+        [=](int id, int count)
+        {
+            size_t begin = fromSize * id / count;
+            size_t end = fromSize * (id + 1) / count;
+            for (size_t i = begin; i < end; i++)
+            {
+                for (TranspositionSlot& slot : from[i].slots)
+                {
+                    uint64_t data = slot.data.load(std::memory_order_relaxed);
+                    if (data == 0)
+                    {
+                        continue;
+                    }
+                    uint64_t zobrist = slot.keyXorData.load(std::memory_order_relaxed) ^ data;
+                    migrateEntry(to[bucketIndex(zobrist, toSize)], zobrist, data);
+                }
+            }
+        }
+    );
+}
+//snapshots hold only the live slots, after a 64 byte little endian header
+//  0  char[4]  magic "LMTT"
+//  4  u32      entry format version
+//  8  u64      hash of the network the evals and scores came from
+// 16  u64      zobrist fingerprint, the keys are only meaningful with the same random keys
+// 24  u64      number of entries
+//each entry is a u64 key ^ data followed by the u64 data word of its slot
+constexpr char SNAPSHOT_MAGIC[4] = {'L', 'M', 'T', 'T'};
+constexpr uint32_t SNAPSHOT_VERSION = 1;
+constexpr size_t SNAPSHOT_HEADER_SIZE = 64;
+constexpr size_t SNAPSHOT_ENTRY_SIZE = 16;
+
+static void putLittleEndian(unsigned char* out, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+    {
+        out[i] = static_cast<unsigned char>(value >> (8 * i));
+    }
+}
+static uint64_t getLittleEndian(const unsigned char* in, int bytes)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++)
+    {
+        value |= uint64_t(in[i]) << (8 * i);
+    }
+    return value;
+}
+
+bool SaveTT(const std::string& filepath, uint64_t& entries)
+{
+    std::ofstream stream(filepath, std::ios::binary);
+    if (!stream || !TranspositionTable)
+    {
+        return false;
+    }
+    unsigned char header[SNAPSHOT_HEADER_SIZE] = {};
+    stream.write(reinterpret_cast<const char*>(header), sizeof(header));
+
+    //written in chunks so a large table never needs a second copy in memory
+    constexpr size_t CHUNK_ENTRIES = 1 << 16;
+    std::vector<unsigned char> chunk;
+    chunk.reserve(CHUNK_ENTRIES * SNAPSHOT_ENTRY_SIZE);
+    entries = 0;
+    for (size_t i = 0; i < TTSize; i++)
+    {
+        for (const TranspositionSlot& slot : TranspositionTable[i].slots)
+        {
+            uint64_t data = slot.data.load(std::memory_order_relaxed);
+            if (data == 0)
+            {
+                continue;
+            }
+            size_t offset = chunk.size();
+            chunk.resize(offset + SNAPSHOT_ENTRY_SIZE);
+            putLittleEndian(chunk.data() + offset, slot.keyXorData.load(std::memory_order_relaxed), 8);
+            putLittleEndian(chunk.data() + offset + 8, data, 8);
+            entries++;
+        }
+        if (chunk.size() >= CHUNK_ENTRIES * SNAPSHOT_ENTRY_SIZE || i + 1 == TTSize)
+        {
+            stream.write(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+            chunk.clear();
+        }
+    }
+
+    memcpy(header, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    putLittleEndian(header + 4, SNAPSHOT_VERSION, 4);
+    putLittleEndian(header + 8, NetworkHash(), 8);
+    putLittleEndian(header + 16, side_key, 8);
+    putLittleEndian(header + 24, entries, 8);
+    stream.seekp(0);
+    stream.write(reinterpret_cast<const char*>(header), sizeof(header));
+    return bool(stream);
+}
+//merges a snapshot into the current table, whatever its size, keeping the more valuable entry on collisions
+bool LoadTT(const std::string& filepath, uint64_t& entries)
+{
+    MappedFile file;
+    if (!TranspositionTable || !file.open(filepath))
+    {
+        std::cerr << "Unable to open hash file: " << filepath << std::endl;
+        return false;
+    }
+    const unsigned char* data = file.data;
+    const char* reason = nullptr;
+    if (file.size < SNAPSHOT_HEADER_SIZE || memcmp(data, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0)
+    {
+        reason = "is not a hash snapshot";
+    }
+    else if (getLittleEndian(data + 4, 4) != SNAPSHOT_VERSION)
+    {
+        reason = "has an unsupported entry format";
+    }
+    else if (getLittleEndian(data + 8, 8) != NetworkHash())
+    {
+        reason = "was written with a different network";
+    }
+    else if (getLittleEndian(data + 16, 8) != side_key)
+    {
+        reason = "was written with different zobrist keys";
+    }
+    //divided rather than multiplied, a forged count could wrap the product around to the real size
+    else if ((file.size - SNAPSHOT_HEADER_SIZE) % SNAPSHOT_ENTRY_SIZE != 0
+             || getLittleEndian(data + 24, 8) != (file.size - SNAPSHOT_HEADER_SIZE) / SNAPSHOT_ENTRY_SIZE)
+    {
+        reason = "is truncated";
+    }
+    if (reason != nullptr)
+    {
+        std::cerr << "Invalid hash file: " << filepath << " " << reason << std::endl;
+        file.close();
+        return false;
+    }
+
+    entries = getLittleEndian(data + 24, 8);
+    const unsigned char* body = data + SNAPSHOT_HEADER_SIZE;
+    uint64_t total = entries;
+    //entries were saved in bucket order, so the slices land in disjoint ranges just like a resize
+    runOnWorkers(
+        [=](int id, int count)
+        {
+            uint64_t begin = total * id / count;
+            uint64_t end = total * (id + 1) / count;
+            for (uint64_t i = begin; i < end; i++)
+            {
+                const unsigned char* entry = body + i * SNAPSHOT_ENTRY_SIZE;
+                uint64_t word = getLittleEndian(entry + 8, 8);
+                if (word == 0)
+                {
+                    continue;
+                }
+                uint64_t zobrist = getLittleEndian(entry, 8) ^ word;
+                //a resumed analysis treats the loaded work as its own
+                uint16_t packedInfo = withGeneration(uint16_t((word >> 32) & 0x7FFF), TTGeneration);
+                word = (word & ~(0x7FFFULL << 32)) | (uint64_t(packedInfo) << 32);
+                migrateEntry(TranspositionTable[ttIndex(zobrist)], zobrist, word);
+            }
+        }
+    );
+    file.close();
+    return true;
 }
 int get_hashfull()
 {
+    //permille of the first 1000 entries used by the current search
     int entryCount = 0;
-    for (int i = 0; i < 1000; i++)
+    for (int i = 0; i < 1000 / TT_BUCKET_ENTRIES; i++)
     {
-        if (unpackBound(TranspositionTable[i].packedInfo) != HFNONE)
+        for (const TranspositionSlot& slot : TranspositionTable[i].slots)
         {
-            entryCount++;
+            uint64_t data = slot.data.load(std::memory_order_relaxed);
+            if (data != 0 && entryAge(uint16_t((data >> 32) & 0x7FFF)) == 0)
+            {
+                entryCount++;
+            }
         }
     }
     return entryCount;
@@ -61,5 +475,5 @@ int adjustMateProbe(int score, int ply)
 }
 void prefetchTT(uint64_t zobrist)
 {
-    __builtin_prefetch(&TranspositionTable[zobrist % TTSize]);
+    __builtin_prefetch(&TranspositionTable[ttIndex(zobrist)]);
 }
\ No newline at end of file
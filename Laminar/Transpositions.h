@@ -1,10 +1,15 @@
 #pragma once
 #include "Movegen.h"
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
+#include <string>
 constexpr int HFLOWER = 0;
 constexpr int HFEXACT = 1;
 constexpr int HFUPPER = 2;
 constexpr int HFNONE = 3;
+//marks an entry that carries no static eval
+constexpr int16_t EVAL_NONE = INT16_MIN;
 struct Move16
 {
     uint16_t data;
@@ -33,6 +38,7 @@ struct Move16
     }
 };
 
+//bits 0-7 depth, 8-9 bound, 10 ttPv, 11-14 generation of the search that stored the entry
 inline uint16_t packData(uint8_t depth, uint8_t bound, bool ttPv)
 {
     return (uint16_t(depth) & 0xFF) | ((uint16_t(bound) & 0x3) << 8) | (uint16_t(ttPv ? 1 : 0) << 10);
@@ -53,23 +59,71 @@ inline bool unpackTtPv(uint16_t data)
     return (data >> 10) & 0x1;
 }
 
-struct TranspositionEntry
+constexpr int TT_GENERATION_BITS = 4;
+constexpr int TT_GENERATION_CYCLE = 1 << TT_GENERATION_BITS;
+
+inline uint8_t unpackGeneration(uint16_t data)
+{
+    return (data >> 11) & (TT_GENERATION_CYCLE - 1);
+}
+
+inline uint16_t withGeneration(uint16_t data, uint8_t generation)
 {
-    uint64_t zobristKey;
-    int32_t score;
+    return (data & 0x7FF) | (uint16_t(generation % TT_GENERATION_CYCLE) << 11);
+}
 
+inline int16_t packEval(int eval)
+{
+    return static_cast<int16_t>(std::clamp(eval, INT16_MIN + 1, INT16_MAX));
+}
+
+//plain copy of an entry handed to search, the table itself stores packed words
+struct TranspositionEntry
+{
+    uint64_t key = 0;
     Move16 bestMove = Move16(0, 0, 0);
+    int32_t score = 0;
     //uint8_t depth;
     //uint8_t bound = HFNONE;
     //bool ttPv = false;
 
     uint16_t packedInfo = packData(0, HFNONE, false);
+
+    //raw network eval of the position, before correction history
+    int16_t staticEval = EVAL_NONE;
+
+    bool matches(uint64_t zobrist) const
+    {
+        return key == zobrist && unpackBound(packedInfo) != HFNONE;
+    }
+};
+
+//an entry is two words written without locks, the first one holds key ^ data
+//a slot torn between two writers no longer verifies against its key and reads as a miss
+struct TranspositionSlot
+{
+    std::atomic<uint64_t> keyXorData{0};
+    std::atomic<uint64_t> data{0};
+};
+
+//one cache line per bucket, so a probe touches a single line
+constexpr int TT_BUCKET_ENTRIES = 4;
+struct alignas(64) TranspositionBucket
+{
+    TranspositionSlot slots[TT_BUCKET_ENTRIES];
 };
+static_assert(sizeof(TranspositionBucket) == 64, "transposition buckets must fill one cache line");
 
 TranspositionEntry ttLookUp(uint64_t zobrist);
 void ClearTT();
+//exchanges the table the probes and stores work on with a caller-owned one, a second swap puts it back
+void SwapTT(TranspositionBucket*& table, size_t& size);
+void ttNewSearch();
+const char* ttPageKind();
+bool SaveTT(const std::string& filepath, uint64_t& entries);
+bool LoadTT(const std::string& filepath, uint64_t& entries);
 
-void ttStore(TranspositionEntry& ttEntry, Board& board);
+void ttStore(TranspositionEntry& ttEntry, uint64_t zobrist);
 int get_hashfull();
 
 void prefetchTT(uint64_t zobrist);
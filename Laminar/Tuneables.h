@@ -118,6 +118,8 @@ constexpr int MAX_CONTHIST = 16384;
 constexpr int RFP_MAX_DEPTH = 6;
 constexpr int MAX_NMP_EVAL_R = 3;
 constexpr int MIN_LMR_DEPTH = 3;
+constexpr int ABDADA_MIN_DEPTH = 5;
+constexpr int ABDADA_LMR_ADD = 1024;
 
 extern Tuneable* AllTuneables[];
 
@@ -4,10 +4,14 @@
 #include "Board.h"
 #include "Evaluation.h"
 #include "Movegen.h"
+#include "NNUE.h"
+#include "Numa.h"
+#include "Repetition.h"
 #include "Search.h"
 #include "Threading.h"
 #include "Transpositions.h"
 #include "Tuneables.h"
+#include <algorithm>
 #include <chrono>
 #include <iomanip>
 #include <iostream>
@@ -17,6 +21,8 @@
 const std::string STARTPOS = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
 const std::string KIWIPETE = "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - ";
 Board mainBoard;
+//keys of every position of the game played so far, the search threads start from a copy of it
+KeyStack mainKeys;
 std::vector<std::string> position_commands = {"position", "startpos", "fen", "moves"};
 std::vector<std::string> go_commands = {"go", "movetime", "wtime", "btime", "winc", "binc", "movestogo"};
 std::vector<std::string> option_commands = {"setoption", "name", "value"};
@@ -107,8 +113,10 @@ static void InitAll()
     InitializeLeaper();
     init_sliders_attacks(1);
     init_sliders_attacks(0);
+    InitLineTables();
     init_tables();
     init_random_keys();
+    InitCuckooTables();
     InitializeLMRTable();
     InitNNUE();
 }
@@ -123,39 +131,28 @@ uint64_t Perft(Board& board, int depth, int perftDepth)
 
     uint64_t nodes = 0;
 
-    GeneratePseudoLegalMoves(move_list, board);
-    AccumulatorPair last_accumulator = board.accumulator;
+    GenerateLegalMoves(move_list, board);
+    //every generated move is legal, so the last ply only needs counting
+    if (depth == 1 && perftDepth > 1)
+    {
+        return move_list.count;
+    }
     for (int i = 0; i < move_list.count; ++i)
     {
         Move& move = move_list.moves[i];
-        int lastEp = board.enpassent;
-        uint8_t lastCastle = board.castle;
-        bool lastside = board.side;
-        int captured_piece = board.mailbox[move.To];
-
-        uint64_t last_zobrist = board.zobristKey;
-        refresh_if_cross(move, board);
-        MakeMove(board, move);
-        if (isLegal(move, board))
+
+        //the board is trivially copyable, so copy-make instead of unmaking
+        Board child = board;
+        MakeMove(child, move);
+        uint64_t nodes_added = Perft(child, depth - 1, perftDepth);
+        nodes += nodes_added;
+        if (depth == perftDepth)
         {
-            uint64_t nodes_added = Perft(board, depth - 1, perftDepth);
-            nodes += nodes_added;
-            if (depth == perftDepth)
-            {
-                printMove(move);
-                std::cout << ":";
-                std::cout << nodes_added;
-                std::cout << "\n";
-            }
+            printMove(move);
+            std::cout << ":";
+            std::cout << nodes_added;
+            std::cout << "\n";
         }
-
-        UnmakeMove(board, move, captured_piece);
-
-        board.zobristKey = last_zobrist;
-        board.enpassent = lastEp;
-        board.castle = lastCastle;
-        board.side = lastside;
-        board.accumulator = last_accumulator;
     }
     return nodes;
 }
@@ -194,7 +191,7 @@ int64_t CalculateSoftLimit(int64_t time, int64_t incre)
             + static_cast<float>(incre) * static_cast<float>(3) / static_cast<float>(4));
 }
 
-void PlayMoves(std::string& moves_string, Board& board)
+void PlayMoves(std::string& moves_string, Board& board, KeyStack& keys)
 {
     if (moves_string != "") // move is not empty
     {
@@ -216,7 +213,7 @@ void PlayMoves(std::string& moves_string, Board& board)
             move_to_play.To = GetSquare(To);
 
             moveList.clear();
-            GeneratePseudoLegalMoves(moveList, board);
+            GenerateLegalMoves(moveList, board);
 
             for (size_t j = 0; j < moveList.count; j++)
             {
@@ -224,7 +221,6 @@ void PlayMoves(std::string& moves_string, Board& board)
                     && (move_to_play.To == moveList.moves[j].To)) //found same move
                 {
                     move_to_play = moveList.moves[j];
-                    refresh_if_cross(move_to_play, board);
                     if ((moveList.moves[j].Type & knight_promo) != 0) // promo
                     {
                         if (promo == "q")
@@ -271,6 +267,17 @@ void PlayMoves(std::string& moves_string, Board& board)
                     }
                 }
             }
+
+            //a move that wasn't found leaves the board as it was
+            if (keys.back() != board.zobristKey)
+            {
+                keys.push_back(board.zobristKey);
+            }
+            //leave room on the key stack for the search
+            if (keys.size() > KEY_STACK_CAPACITY - MAXPLY - 1)
+            {
+                TrimKeyHistory(keys, board);
+            }
         }
     }
 }
@@ -290,6 +297,17 @@ void ProcessUCI(std::string input)
         std::cout << "\n";
         std::cout << "option name Threads type spin default 1 min 1 max 1024\n";
         std::cout << "option name Hash type spin default 12 min 1 max 4096\n";
+        std::cout << "option name EvalCache type spin default " << EVAL_CACHE_DEFAULT_KB << " min 0 max "
+                  << EVAL_CACHE_MAX_KB << "\n";
+        std::cout << "option name EvalFile type string default <internal>\n";
+        std::cout << "option name NumaAware type check default true\n";
+        std::cout << "option name Ponder type check default false\n";
+        std::cout << "option name SimdKernels type combo default auto var auto";
+        for (int level = SIMD_SCALAR; level <= DetectSimdLevel(); level++)
+        {
+            std::cout << " var " << SimdLevelName(SimdLevel(level));
+        }
+        std::cout << "\n";
 
         /*     for (int i = 0; i < AllTuneablesCount; i++)
         {
@@ -300,6 +318,7 @@ void ProcessUCI(std::string input)
             std::cout << " max " << AllTuneables[i]->maxValue;
             std::cout << "\n";
         }*/
+        std::cout << "info string using " << SimdLevelName(KernelLevel()) << " NNUE kernels\n";
         std::cout << "uciok"
                   << "\n";
         IsUCI = true;
@@ -322,12 +341,17 @@ void ProcessUCI(std::string input)
     else if (mainCommand == "ucinewgame")
     {
         stopCurrentSearch();
+        auto start = std::chrono::steady_clock::now();
         ClearTT();
+        auto end = std::chrono::steady_clock::now();
+        int64_t elapsedMS = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+        std::cout << "info string hash cleared by " << std::max<size_t>(threadPool.size(), 1) << " threads in "
+                  << elapsedMS << " ms\n";
         InitAll();
         for (auto& worker : threadPool)
         {
             std::lock_guard<std::mutex> lock(worker->mtx);
-            InitializeSearch(worker->data);
+            InitializeSearch(*worker->data);
         }
     }
     else if (mainCommand == "isready")
@@ -342,15 +366,91 @@ void ProcessUCI(std::string input)
 
         if (option == "Hash")
         {
+            stopCurrentSearch();
+            auto start = std::chrono::steady_clock::now();
             Initialize_TT(value);
+            auto end = std::chrono::steady_clock::now();
+            int64_t elapsedMS = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+            std::cout << "info string hash " << value << " MB on " << ttPageKind() << " pages, resized by "
+                      << std::max<size_t>(threadPool.size(), 1) << " threads in " << elapsedMS << " ms\n";
+        }
+        if (option == "EvalFile")
+        {
+            std::string path = TryGetLabelledValue(input, "value", option_commands);
+            stopCurrentSearch();
+            bool loaded;
+            if (path.empty() || path == "<internal>")
+            {
+                loaded = LoadDefaultNetwork();
+            }
+            else
+            {
+                loaded = LoadNetwork(path);
+                if (!loaded)
+                {
+                    std::cout << "info string failed to load " << path << ", keeping " << NetworkSource() << "\n";
+                }
+            }
+            //cached evals and the static evals stored with every hash entry belong to the previous network
+            if (loaded)
+            {
+                for (auto& worker : threadPool)
+                {
+                    worker->data->evalCache.clear();
+                }
+                ClearTT();
+                std::cout << "info string hash cleared for the new network\n";
+            }
+            if (EvalNetwork.weights != nullptr)
+            {
+                std::cout << "info string using network " << NetworkSource() << " (" << INPUT_SIZE << "->"
+                          << EvalNetwork.arch->hiddenSize << ")\n";
+            }
+        }
+        else if (option == "EvalCache")
+        {
+            stopCurrentSearch();
+            EvalCacheSize = std::clamp(value, 0, EVAL_CACHE_MAX_KB);
+            for (auto& worker : threadPool)
+            {
+                std::lock_guard<std::mutex> lock(worker->mtx);
+                worker->data->evalCache.resize(EvalCacheSize);
+            }
+        }
+        else if (option == "SimdKernels")
+        {
+            std::string name = TryGetLabelledValue(input, "value", option_commands);
+            SimdLevel level = DetectSimdLevel();
+            for (int i = SIMD_SCALAR; i < SIMD_LEVEL_COUNT; i++)
+            {
+                if (name == SimdLevelName(SimdLevel(i)))
+                {
+                    level = SimdLevel(i);
+                }
+            }
+            stopCurrentSearch();
+            if (!SetKernelLevel(level))
+            {
+                std::cout << "info string " << name << " is not supported by this CPU\n";
+            }
+            std::cout << "info string using " << SimdLevelName(KernelLevel()) << " NNUE kernels\n";
         }
-        if (option == "Threads")
+        else if (option == "Threads")
         {
             threadCount = value;
             stopCurrentSearch();
             destroyWorkers();
             startWorkers(threadCount);
         }
+        else if (option == "NumaAware")
+        {
+            NumaAware = TryGetLabelledValue(input, "value", option_commands) == "true";
+            stopCurrentSearch();
+            destroyWorkers();
+            startWorkers(threadCount);
+            std::cout << "info string NUMA aware placement " << (NumaAware ? "on" : "off") << ", " << NumaNodeCount()
+                      << " nodes\n";
+        }
         else
         {
             for (int i = 0; i < AllTuneablesCount; i++)
@@ -366,6 +466,10 @@ void ProcessUCI(std::string input)
     {
         stopCurrentSearch();
     }
+    else if (mainCommand == "ponderhit")
+    {
+        ponderHit();
+    }
     else if (mainCommand == "quit")
     {
         stopCurrentSearch();
@@ -377,6 +481,13 @@ void ProcessUCI(std::string input)
         stopCurrentSearch();
         SearchLimitations searchLimits = SearchLimitations();
         int depth = MAXPLY;
+        //the position already has the predicted move played, only the clock is held back
+        auto ponderFlag = std::find(Commands.begin(), Commands.end(), "ponder");
+        bool ponder = ponderFlag != Commands.end();
+        if (ponder)
+        {
+            Commands.erase(ponderFlag);
+        }
 
         if (Commands.size() == 1 || Commands[1] == "infinite")
         {
@@ -422,7 +533,7 @@ void ProcessUCI(std::string input)
         {
             searchLimits.HardNodeLimit = TryGetLabelledValueInt(input, "nodes", go_commands);
         }
-        startSearch(mainBoard, searchLimits, depth);
+        startSearch(mainBoard, mainKeys, searchLimits, depth, ponder);
     }
     else if (mainCommand == "perft")
     {
@@ -448,13 +559,15 @@ void ProcessUCI(std::string input)
             if (Commands.size() == 2)
             {
                 parse_fen(STARTPOS, mainBoard);
+                mainKeys.reset(mainBoard.zobristKey);
             }
             else
             {
                 parse_fen(STARTPOS, mainBoard);
+                mainKeys.reset(mainBoard.zobristKey);
 
                 std::string moves_in_string = TryGetLabelledValue(input, "moves", position_commands);
-                PlayMoves(moves_in_string, mainBoard);
+                PlayMoves(moves_in_string, mainBoard, mainKeys);
             }
         }
         else if (Commands[1] == "fen")
@@ -465,19 +578,81 @@ void ProcessUCI(std::string input)
             if (moves == "")
             {
                 parse_fen(fen, mainBoard);
+                mainKeys.reset(mainBoard.zobristKey);
             }
             else
             {
                 parse_fen(fen, mainBoard);
+                mainKeys.reset(mainBoard.zobristKey);
                 std::string moves_in_string = TryGetLabelledValue(input, "moves", position_commands);
-                PlayMoves(moves_in_string, mainBoard);
+                PlayMoves(moves_in_string, mainBoard, mainKeys);
             }
         }
     }
     else if (mainCommand == "bench")
     {
+        waitForSearch();
         bench();
     }
+    else if (mainCommand == "nnuebench")
+    {
+        nnueBench();
+    }
+    else if (mainCommand == "ttstress")
+    {
+        int threads = Commands.size() > 1 ? std::stoi(Commands[1]) : int(std::thread::hardware_concurrency());
+        stopCurrentSearch();
+        ttStress(std::max(threads, 1));
+    }
+    else if (mainCommand == "ttdbench")
+    {
+        int maxThreads = Commands.size() > 1 ? std::stoi(Commands[1]) : int(std::thread::hardware_concurrency());
+        int depth = Commands.size() > 2 ? std::stoi(Commands[2]) : 12;
+        stopCurrentSearch();
+        timeToDepth(std::max(maxThreads, 1), depth);
+        destroyWorkers();
+        startWorkers(threadCount);
+    }
+    else if (mainCommand == "savehash" && Commands.size() > 1)
+    {
+        std::string path = trim(input.substr(input.find("savehash") + 8));
+        uint64_t entries = 0;
+        stopCurrentSearch();
+        if (SaveTT(path, entries))
+        {
+            std::cout << "info string saved " << entries << " hash entries to " << path << "\n";
+        }
+        else
+        {
+            std::cout << "info string failed to write " << path << "\n";
+        }
+    }
+    else if (mainCommand == "loadhash" && Commands.size() > 1)
+    {
+        std::string path = trim(input.substr(input.find("loadhash") + 8));
+        uint64_t entries = 0;
+        stopCurrentSearch();
+        auto start = std::chrono::steady_clock::now();
+        if (LoadTT(path, entries))
+        {
+            auto end = std::chrono::steady_clock::now();
+            int64_t elapsedMS = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+            std::cout << "info string loaded " << entries << " hash entries from " << path << " in " << elapsedMS
+                      << " ms\n";
+        }
+        else
+        {
+            std::cout << "info string failed to load " << path << "\n";
+        }
+    }
+    else if (mainCommand == "savenet" && Commands.size() > 1)
+    {
+        std::string path = trim(input.substr(input.find("savenet") + 7));
+        if (!SaveNetwork(path))
+        {
+            std::cout << "info string failed to write " << path << "\n";
+        }
+    }
     else if (mainCommand == "show")
     {
         PrintBoards(mainBoard);
@@ -486,11 +661,13 @@ void ProcessUCI(std::string input)
     else if (mainCommand == "moves")
     {
         std::string moves_in_string = TryGetLabelledValue(input, "moves", position_commands);
-        PlayMoves(moves_in_string, mainBoard);
+        PlayMoves(moves_in_string, mainBoard, mainKeys);
     }
     else if (mainCommand == "eval")
     {
-        int eval = Evaluate(mainBoard);
+        AccumulatorPair accumulator;
+        resetAccumulators(mainBoard, accumulator);
+        int eval = Evaluate(mainBoard, accumulator);
 
         std::cout << ("evaluation: ") << eval << "cp ";
         if (mainBoard.side == White)
@@ -512,9 +689,10 @@ int main(int argc, char* argv[])
     for (auto& worker : threadPool)
     {
         std::lock_guard<std::mutex> lock(worker->mtx);
-        InitializeSearch(worker->data);
+        InitializeSearch(*worker->data);
     }
     parse_fen(STARTPOS, mainBoard);
+    mainKeys.reset(mainBoard.zobristKey);
     Initialize_TT(32); //set initial TT size as 32mb
     threadCount = 1;
     startWorkers(threadCount);